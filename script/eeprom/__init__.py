@@ -0,0 +1,12 @@
+# Host side of the AT28C256 programmer. write-rom.py is the command line
+# front end. Build tools can import this instead:
+#
+#   from eeprom import Options, burn, load_image
+#   image = load_image('rom.s19', 'auto', 0)
+#   result = burn('/dev/ttyUSB0', image, Options(), progress=print)
+
+from .burn import Options, Result, burn, burn_all, expand_ports
+from .chips import CHIPS, DEFAULT_CHIP, Chip
+from .image import Image, load_image
+from .protocol import Progress
+from .transport import Connection
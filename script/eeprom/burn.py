@@ -0,0 +1,288 @@
+# A whole session with one arduino, or several at once.
+
+import binascii
+import copy
+import glob
+import os
+import serial
+import threading
+import time
+
+from dataclasses import dataclass
+
+from .chips import DEFAULT_CHIP
+from .image import apply_image, fill_image, fill_image_from_data, image_records, with_fills
+from .journal import Journal
+from .log import device, printn, printv
+from .manifest import data_pagemap, load_manifest, save_manifest
+from .plan import choose_plan, confirm_erased, make_plans
+from .protocol import (BAUD_RATES, Link, ResetException, expect_ack, fill_image_from_rom,
+    get_checksum, get_info, get_pagemap, get_write_cycles, negotiate_baud, negotiate_binary, negotiate_force,
+    negotiate_packed, negotiate_window, read_rom, report_counters, report_write_cycles, send,
+    send_file, unverified_records)
+from .stats import Stats
+from .transport import Connection, Recorder
+
+# Returns the ports named by spec, a comma separated list of devices or globs.
+def expand_ports(spec):
+    ports = []
+    for name in spec.split(','):
+        matches = sorted(glob.glob(name)) if glob.has_magic(name) else [name]
+        if not matches:
+            raise RuntimeError(f'No ports match {name}')
+        ports += [m for m in matches if m not in ports]
+    return ports
+
+@dataclass
+class Result:
+    port: str
+    error: str = None
+    size: int = 0
+    elapsed: float = 0
+
+# What to do in a session, with the same defaults as write-rom.py.
+@dataclass
+class Options:
+    speed: int = 115200
+    baud: str = None
+    ascii: bool = False
+    window: int = 8
+    no_packed: bool = False
+    no_pagemap: bool = False
+    poll: str = None
+    stats: bool = False
+    dump: str = None
+    erase: bool = False
+    fill: int = None
+    manifests: str = None
+    plan: str = 'auto'
+    # What to assume if the firmware is too old to say
+    chip: object = DEFAULT_CHIP
+    # Keep a transcript of the session in this file, for src/native/replay.cpp
+    record: str = None
+    # Keep a journal of each burn in this directory, to resume it from. Only
+    # useful without a page map, which skips the pages written already.
+    journal: str = None
+
+# Returns what the chip holds, from its manifest in directory, or None if it
+# doesn't have one.
+def find_manifest(port, directory, chip):
+    crc = get_checksum(port, 0, chip.size)
+    if crc is None:
+        return None
+    rom = load_manifest(directory, crc, chip)
+    if rom is None:
+        printn(f'No manifest for this chip ({crc:08x}), checking the page map')
+    return rom
+
+# Saves a manifest of what the chip holds now, which is rom with the image
+# written over it. If we didn't know what it held before, the pages the image
+# doesn't cover are read back first.
+def update_manifest(port, directory, image, rom):
+    chip = image.chip
+    crc = get_checksum(port, 0, chip.size)
+    if crc is None:
+        return
+    if rom is None:
+        unknown = [p for p in range(chip.page_count) if p not in image or not all(image[p].covered)]
+        printn(f'Reading {len(unknown)} pages to start a manifest')
+        data = bytearray(chip.size)
+        size = chip.page_size
+        runs = []
+        for p in unknown:
+            if runs and runs[-1][1] == p:
+                runs[-1][1] += 1
+            else:
+                runs.append([p, p + 1])
+        try:
+            for (first, end) in runs:
+                data[first * size:end * size] = read_rom(port, first * size, (end - first) * size)
+        except RuntimeError as e:
+            printv(f'Can\'t read the ROM for the manifest ({e})')
+            return
+        rom = data
+    data = apply_image(rom, image)
+    if binascii.crc32(data) != crc:
+        printn('The chip doesn\'t hold what we expected, not saving a manifest')
+        return
+    save_manifest(directory, data)
+
+# Runs the whole session with the arduino on port_name: dump, erase, and
+# writing the image, if there is one. The image is left untouched, so several
+# threads can share it. progress is called as described in protocol.Progress.
+def burn(port_name, image, options, progress=None):
+    result = Result(port_name)
+    start = time.monotonic()
+    device.stats = Stats() if options.stats else None
+    try:
+        recorder = None if options.record is None else Recorder(options.record, f'Recorded from {port_name}')
+        with serial.Serial(port_name, options.speed, timeout=1) as serial_port, \
+                Connection(serial_port, recorder) as port:
+
+            ready = False
+            while not ready:
+                try:
+                    send(port, 'BEGIN')
+                    expect_ack(port, 'BEGIN')
+                    ready = True
+                except ResetException:
+                    printn("Ignoring RESET, resending BEGIN")
+                    # Fix the serial port setup and retry
+                    os.system(f'stty -F {port_name} -hupcl')
+
+            if options.baud is not None:
+                rates = BAUD_RATES if options.baud == 'auto' else [int(options.baud)]
+                rate = negotiate_baud(port, rates)
+                printn(f'Using {rate} baud')
+
+            link = Link()
+            link.binary = not options.ascii and negotiate_binary(port)
+            if link.binary and options.window > 1:
+                link.window = negotiate_window(port, options.window)
+            if link.binary and not options.no_packed:
+                link.packed = negotiate_packed(port)
+            link.force = negotiate_force(port)
+
+            chip = get_info(port) or options.chip
+            printv(f'Chip is {chip.name}')
+
+            if options.poll is not None:
+                send(port, f'POLL {options.poll.upper()}')
+                expect_ack(port, 'POLL')
+
+            if device.stats is not None:
+                send(port, 'TIMING ON')
+                try:
+                    expect_ack(port, 'TIMING')
+                except RuntimeError as e:
+                    printn(f'Phase times not available ({e})')
+
+            # What the chip holds, if we know
+            rom = None
+
+            if options.dump is not None:
+                printn(f'Reading {chip.size} bytes')
+                rom = read_rom(port, 0, chip.size, progress)
+                with open(options.dump, 'wb') as f:
+                    f.write(rom)
+
+            if options.erase:
+                send(port, 'ERASE')
+                expect_ack(port, 'ERASE')
+                rom = bytes([0xff]) * chip.size
+
+            if image is not None:
+                if image.chip != chip:
+                    raise RuntimeError(f'The arduino is set up for a {chip.name}, not a {image.chip.name} '
+                                       f'(see --chip)')
+                journal = None
+                if options.journal is not None:
+                    journal = Journal(options.journal, image, port_name)
+                    if options.erase:
+                        journal.clear()
+                image = copy.deepcopy(image)
+                if rom is None and options.manifests is not None:
+                    rom = find_manifest(port, options.manifests, chip)
+                # Make the partial pages whole, so each page is a single write
+                if options.fill is not None:
+                    fill_image(image, options.fill)
+                elif rom is not None:
+                    fill_image_from_data(image, rom)
+                else:
+                    fill_image_from_rom(port, image)
+                # Skip the pages that are already correct. If we know what the
+                # chip holds, the rest are known to have changed, and needn't
+                # be checked before they're written.
+                if options.no_pagemap:
+                    pagemap = None
+                elif rom is not None:
+                    pagemap = data_pagemap(rom, chip)
+                else:
+                    pagemap = get_pagemap(port, chip)
+                # With a page map, there's a choice of how to go about it
+                if pagemap is not None and not options.erase:
+                    # Plan with the write cycle time the arduino last measured,
+                    # or the datasheet's worst case if it hasn't yet
+                    (_, _, avg_us, _, last_avg_us) = get_write_cycles(port)
+                    twc_us = avg_us or last_avg_us or chip.twc_us
+                    printv(f'Planning with a {twc_us} us write cycle')
+                    plans = make_plans(image, pagemap, rom, link, port.baudrate, twc_us)
+                    plan = choose_plan(plans, options.plan)
+                    if plan.name == 'erase' and not confirm_erased(port, image, rom):
+                        if options.plan == 'erase':
+                            raise RuntimeError('Some pages outside the file aren\'t blank, not erasing')
+                        printn('Some pages outside the file aren\'t blank, writing incrementally')
+                        plan = plans[0]
+                    printn(f'Using {plan.name}')
+                    if plan.name == 'erase':
+                        send(port, 'ERASE')
+                        expect_ack(port, 'ERASE')
+                        if journal is not None:
+                            journal.clear()
+                        rom = bytes([0xff]) * chip.size
+                        pagemap = data_pagemap(rom, chip)
+                    else:
+                        pagemap = plan.pagemap
+                    image = plan.image
+                force = rom is not None and pagemap is not None
+                records = image_records(image, pagemap)
+                if pagemap is not None:
+                    changed = len({ r.address >> chip.page_bits for r in records.records })
+                    printn(f'{len(image) - changed} of {len(image)} pages unchanged')
+                if journal is not None:
+                    records = journal.resume(port, records)
+                # Send all the records in update mode, with runs of padding as FILLs
+                result.size = records.size
+                updated = send_file(with_fills(records) if link.packed else records, port, False, link,
+                                    progress, force, journal)
+                # Check the whole file, not just what was sent, since a page the
+                # page map skipped only had its CRC16 match. The runs that don't
+                # match are written again, which only changes the pages that
+                # differ, then checked page by page.
+                everything = image_records(image)
+                unverified = unverified_records(port, everything)
+                if unverified.pages > 0:
+                    updated += send_file(unverified, port, False, link, progress, journal=journal)
+                    send_file(unverified, port, True, link, progress, journal=journal)
+                else:
+                    printn(f'Verified {everything.size} bytes by checksum')
+                if updated > 0:
+                    report_write_cycles(port)
+                if journal is not None:
+                    journal.finish()
+                if options.manifests is not None:
+                    update_manifest(port, options.manifests, image, rom)
+                if device.stats is not None:
+                    device.stats.report()
+                    report_counters(port)
+            elif not options.erase and options.dump is None:
+                printn("No file specified, and not erasing. Nothing to do.")
+
+            send(port, 'END')
+            expect_ack(port, 'END')
+            printn("Done")
+
+    except Exception as e:
+        prefix = "NAK:"
+        msg = str(e)
+        result.error = msg[len(prefix):] if msg.startswith(prefix) else msg
+        printn(result.error)
+    result.elapsed = time.monotonic() - start
+    return result
+
+# Burns each port in its own thread. Returns a Result for each, and how long
+# it took overall.
+def burn_all(ports, image, options, progress=None):
+    results = [None] * len(ports)
+
+    def run(i):
+        device.name = ports[i]
+        results[i] = burn(ports[i], image, options, progress)
+
+    start = time.monotonic()
+    threads = [threading.Thread(target=run, args=(i,)) for i in range(len(ports))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return (results, time.monotonic() - start)
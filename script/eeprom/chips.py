@@ -0,0 +1,30 @@
+# The parts the firmware can be built for, the same as c_chips in
+# src/chips.h. Newer firmware says which it is with INFO, older firmware is
+# always an AT28C256. Addresses go over the wire in 16 bits, so nothing is
+# bigger than 32K.
+
+from dataclasses import dataclass
+
+@dataclass(frozen=True)
+class Chip:
+    name: str
+    size: int
+    page_bits: int
+    twc_us: int
+    erase: bool
+
+    @property
+    def page_size(self):
+        return 1 << self.page_bits
+
+    @property
+    def page_count(self):
+        return self.size // self.page_size
+
+CHIPS = { c.name: c for c in [
+    Chip('28C64', 8 * 1024, 6, 10000, False),
+    Chip('28C256', 32 * 1024, 6, 10000, True),
+    Chip('28C256-128', 32 * 1024, 7, 10000, True),
+] }
+
+DEFAULT_CHIP = CHIPS['28C256']
@@ -0,0 +1,215 @@
+# Loading SREC, Intel HEX and binary files into an image of the ROM, and
+# turning the image into the records we send.
+
+import binascii
+import struct
+
+from dataclasses import dataclass
+
+from .chips import DEFAULT_CHIP
+from .log import printv
+
+def file_err(line_num, message):
+    raise RuntimeError(f'Line {line_num} {message}')
+
+@dataclass
+class Record:
+    address: int
+    size: int
+    data: bytes
+
+# A run of whole pages that are all one value, which can go as a single FILL.
+@dataclass
+class Fill:
+    address: int
+    size: int
+    value: int
+
+@dataclass
+class ROM:
+    size: int
+    pages: int
+    records: [Record]
+    chip: object
+
+# The file is loaded into a sparse image of the ROM, a page at a time, so we
+# can send one write per page however the file splits up its records. Each
+# page keeps track of which of its bytes the file covers. Later records
+# overwrite earlier ones.
+@dataclass
+class Page:
+    data: bytearray
+    covered: [bool]
+
+# The pages, by page number, for a particular chip.
+class Image(dict):
+    def __init__(self, chip, *args):
+        super().__init__(*args)
+        self.chip = chip
+
+def image_write(image, line_num, address, data):
+    chip = image.chip
+    if address < 0 or address + len(data) > chip.size:
+        file_err(line_num, f'address 0x{address:x} is outside {chip.size // 1024}k (see --base)')
+    for (offset, value) in enumerate(data, address):
+        page = image.setdefault(offset >> chip.page_bits,
+                                Page(bytearray(chip.page_size), [False] * chip.page_size))
+        page.data[offset & (chip.page_size - 1)] = value
+        page.covered[offset & (chip.page_size - 1)] = True
+
+def parse_hex(line_num, line):
+    try:
+        return bytes.fromhex(line)
+    except ValueError:
+        file_err(line_num, 'isn\'t valid hex')
+
+# S1, S2 and S3 records have 16, 24 and 32 bit addresses. The other record
+# types are headers, counts and start addresses, which we don't need.
+SREC_ADDRESS_SIZES = { '1': 2, '2': 3, '3': 4 }
+
+def parse_srec(f, image, base):
+    for (line_num, line) in enumerate(f, 1):
+        line = line.strip()
+        if len(line) == 0:
+            continue
+        if line[0] != 'S' or len(line) < 4:
+            file_err(line_num, 'doesn\'t look like an SREC record')
+        raw = parse_hex(line_num, line[2:])
+        if raw[0] != len(raw) - 1:
+            file_err(line_num, f'length doesn\'t match byte count len={len(raw) - 1} bc={raw[0]}')
+        if sum(raw) & 0xff != 0xff:
+            file_err(line_num, 'has a bad checksum')
+        address_size = SREC_ADDRESS_SIZES.get(line[1])
+        if address_size is None:
+            continue
+        address = int.from_bytes(raw[1:1 + address_size], 'big')
+        image_write(image, line_num, address - base, raw[1 + address_size:-1])
+
+def parse_ihex(f, image, base):
+    upper = 0
+    for (line_num, line) in enumerate(f, 1):
+        line = line.strip()
+        if len(line) == 0:
+            continue
+        if line[0] != ':':
+            file_err(line_num, 'doesn\'t look like an Intel HEX record')
+        raw = parse_hex(line_num, line[1:])
+        if len(raw) < 5 or raw[0] != len(raw) - 5:
+            file_err(line_num, f'length doesn\'t match byte count')
+        if sum(raw) & 0xff != 0:
+            file_err(line_num, 'has a bad checksum')
+        (address, kind, data) = (int.from_bytes(raw[1:3], 'big'), raw[3], raw[4:-1])
+        if kind == 0x00:
+            image_write(image, line_num, upper + address - base, data)
+        elif kind == 0x01:
+            break
+        elif kind == 0x02:
+            upper = int.from_bytes(data, 'big') << 4
+        elif kind == 0x04:
+            upper = int.from_bytes(data, 'big') << 16
+        # 0x03 and 0x05 are start addresses.
+
+# Binary files are loaded at the start of the ROM.
+def parse_bin(f, image):
+    data = f.read()
+    if len(data) > image.chip.size:
+        raise RuntimeError(f'File is {len(data)} bytes, which is bigger than {image.chip.size // 1024}k')
+    image_write(image, 0, 0, data)
+
+# Text formats are recognised by their first character, anything else is
+# loaded as binary.
+def guess_format(filename):
+    if filename.lower().endswith('.bin'):
+        return 'bin'
+    with open(filename, 'rb') as f:
+        first = f.read(1)
+    return { b'S': 'srec', b':': 'ihex' }.get(first, 'bin')
+
+def load_image(filename, format, base, chip=DEFAULT_CHIP):
+    if format == 'auto':
+        format = guess_format(filename)
+    printv(f'Loading {filename} as {format}')
+    image = Image(chip)
+    if format == 'bin':
+        with open(filename, 'rb') as f:
+            parse_bin(f, image)
+    else:
+        with open(filename) as f:
+            (parse_srec if format == 'srec' else parse_ihex)(f, image, base)
+    return image
+
+def fill_image(image, fill):
+    for page in image.values():
+        complete_page(page, bytes([fill]) * len(page.data))
+
+# Fills the gaps in the page from data, which is what the whole page holds now.
+def complete_page(page, data):
+    page.data = bytearray(page.data[i] if page.covered[i] else data[i] for i in range(len(page.data)))
+    page.covered = [True] * len(page.data)
+
+# Fills the gaps in every page from rom, a copy of the whole ROM.
+def fill_image_from_data(image, rom):
+    for (page_num, page) in image.items():
+        address = page_num << image.chip.page_bits
+        complete_page(page, rom[address:address + image.chip.page_size])
+
+# Returns rom, a copy of the whole ROM, with the image written over it.
+def apply_image(rom, image):
+    data = bytearray(rom)
+    for (page_num, page) in image.items():
+        for i in range(image.chip.page_size):
+            if page.covered[i]:
+                data[(page_num << image.chip.page_bits) + i] = page.data[i]
+    return bytes(data)
+
+# Returns a record for each page, in address order. Pages that still have gaps
+# get a record for each run of bytes the file covers. If there's a page map,
+# complete pages that already hold the right data are left out.
+def image_records(image, pagemap=None):
+    (page_bits, page_size) = (image.chip.page_bits, image.chip.page_size)
+    records = []
+    for (page_num, page) in sorted(image.items()):
+        if pagemap is not None and all(page.covered) \
+                and binascii.crc_hqx(page.data, 0) == pagemap[page_num]:
+            continue
+        offset = 0
+        while offset < page_size:
+            if not page.covered[offset]:
+                offset += 1
+                continue
+            end = offset
+            while end < page_size and page.covered[end]:
+                end += 1
+            address = (page_num << page_bits) + offset
+            records.append(Record(address, end - offset, bytes(page.data[offset:end])))
+            offset = end
+    return ROM(sum(r.size for r in records), len(records), records, image.chip)
+
+# Replaces each run of at least FILL_MIN_PAGES whole pages, that are all the
+# same value, with a Fill. Shorter runs are cheap enough as packed frames.
+FILL_MIN_PAGES = 2
+
+def with_fills(f):
+    page_size = f.chip.page_size
+    records = []
+    for record in f.records:
+        value = record.data[0]
+        if record.size != page_size or record.data.count(value) != page_size:
+            records.append(record)
+            continue
+        last = records[-1] if records else None
+        if isinstance(last, Fill) and last.value == value and last.address + last.size == record.address:
+            last.size += page_size
+        else:
+            records.append(Fill(record.address, page_size, value))
+    records = sum((fill_records(r, page_size) if isinstance(r, Fill) and r.size < FILL_MIN_PAGES * page_size
+                   else [r] for r in records), [])
+    return ROM(f.size, len(records), records, f.chip)
+
+def fill_records(fill, page_size):
+    return [ Record(address, page_size, bytes([fill.value]) * page_size)
+             for address in range(fill.address, fill.address + fill.size, page_size) ]
+
+def s1_line(record):
+    body = struct.pack('>BH', record.size + 3, record.address) + record.data
+    return 'S1' + body.hex().upper() + f'{~sum(body) & 0xff:02X}'
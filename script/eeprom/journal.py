@@ -0,0 +1,119 @@
+# A journal of how far a burn got, so when one dies partway, from a cable
+# getting knocked or the arduino resetting, running it again can carry on
+# from there rather than sending and verifying every page from the start.
+#
+# There's a file for each image and port, added to as each record is sent
+# and ACKed, and removed once the burn has finished. Each line is a record:
+#
+#   > 01c0 64 9a3b55e0      sent
+#   W 01c0 64 9a3b55e0      ACKed, with what happened, as in Progress.op
+#
+# with its address, size and CRC32, so a record only counts if it's exactly
+# what the burn would send now. The ones sent but never ACKed were in flight
+# when it died, and may or may not have been written.
+#
+# The journal is resumed after the page map has dropped the pages that are
+# already right, so with a page map there's rarely anything left for it to
+# skip. It's for --no-pagemap, and firmware without PAGEMAP, where the
+# alternative is sending and verifying everything again.
+
+import binascii
+import os
+
+from .image import ROM, Fill, fill_records
+from .log import printn, printv
+from .protocol import contiguous_runs, get_checksum
+
+def record_key(record):
+    return (record.address, record.size, binascii.crc32(record.data))
+
+# The CRC32 of everything the file says to write, to name its journals by.
+def image_crc(image):
+    crc = binascii.crc32(image.chip.name.encode())
+    for (page_num, page) in sorted(image.items()):
+        crc = binascii.crc32(page_num.to_bytes(2, 'big'), crc)
+        crc = binascii.crc32(page.data, crc)
+        crc = binascii.crc32(bytes(page.covered), crc)
+    return crc
+
+class Journal:
+    def __init__(self, directory, image, port_name):
+        os.makedirs(directory, exist_ok=True)
+        self.path = os.path.join(directory, f'{image_crc(image):08x}-{os.path.basename(port_name)}.journal')
+        self.page_size = image.chip.page_size
+        self.sent_keys = set()
+        self.acked_keys = set()
+        try:
+            with open(self.path) as f:
+                for line in f:
+                    self.load_line(line)
+        except FileNotFoundError:
+            pass
+
+    # A line cut short when the last run died is ignored, like any other
+    # that doesn't make sense.
+    def load_line(self, line):
+        fields = line.split()
+        if len(fields) != 4:
+            return
+        try:
+            key = (int(fields[1], 16), int(fields[2]), int(fields[3], 16))
+        except ValueError:
+            return
+        if fields[0] == '>':
+            self.sent_keys.add(key)
+        else:
+            self.acked_keys.add(key)
+
+    # A FILL is noted as the page records it stands for, which is how the
+    # next run will see them before with_fills.
+    def write(self, op, record):
+        records = fill_records(record, self.page_size) if isinstance(record, Fill) else [record]
+        with open(self.path, 'a') as f:
+            for r in records:
+                (address, size, crc) = record_key(r)
+                f.write(f'{op} {address:04x} {size} {crc:08x}\n')
+
+    def sent(self, record):
+        self.write('>', record)
+
+    def acked(self, record, op):
+        self.write(op, record)
+
+    # Forgets everything, after the chip has been erased.
+    def clear(self):
+        self.sent_keys.clear()
+        self.acked_keys.clear()
+        if os.path.exists(self.path):
+            os.remove(self.path)
+
+    # The burn is done, so there's nothing to resume.
+    def finish(self):
+        self.clear()
+
+    # Returns the records the last run didn't get done. Those it got ACKs for
+    # are checked with a CHECKSUM for each run of them, in case something
+    # else has written the chip since. Those that were in flight are checked
+    # one by one, so a single bad page doesn't mean resending a whole run.
+    def resume(self, port, f):
+        acked = [r for r in f.records if record_key(r) in self.acked_keys]
+        in_flight = [r for r in f.records
+                     if record_key(r) in self.sent_keys and record_key(r) not in self.acked_keys]
+        if not acked and not in_flight:
+            return f
+        done = set()
+        for run in contiguous_runs(acked):
+            data = b''.join(r.data for r in run)
+            crc = get_checksum(port, run[0].address, len(data))
+            if crc is None or crc == binascii.crc32(data):
+                done.update(id(r) for r in run)
+            else:
+                printv(f'0x{run[0].address:04x}-0x{run[0].address + len(data) - 1:04x} '
+                       f'has changed since the last run')
+        for r in in_flight:
+            if get_checksum(port, r.address, r.size) == binascii.crc32(r.data):
+                done.add(id(r))
+        records = [r for r in f.records if id(r) not in done]
+        printn(f'Resuming: {len(f.records) - len(records)} of {len(f.records)} records '
+               f'were written by the last run')
+        return ROM(sum(r.size for r in records), len(records), records, f.chip)
@@ -0,0 +1,24 @@
+# Messages for the user. When burning several arduinos at once, each gets its
+# own thread, and its messages are prefixed with its port name.
+
+import threading
+
+# Set by --verbose.
+verbose = False
+
+# What we know about the arduino this thread is talking to.
+class Device(threading.local):
+    name = None
+    # Set by --stats, see stats.py.
+    stats = None
+
+device = Device()
+print_lock = threading.RLock()
+
+def printn(string):
+    with print_lock:
+        print(string if device.name is None else f'{device.name}: {string}', flush=True)
+
+def printv(string):
+    if verbose:
+        printn(string)
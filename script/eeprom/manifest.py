@@ -0,0 +1,44 @@
+# Manifests record what a chip holds, so the next burn can work out which
+# pages have changed without the arduino checking them. Each is a copy of the
+# whole ROM, named after its CRC32. The arduino reports the CRC32 of the chip
+# with CHECKSUM, so a chip that has been changed since, by us or anything
+# else, just doesn't find one, and we go back to the page map.
+
+import binascii
+import os
+import threading
+
+from .log import printv
+
+def manifest_path(directory, crc):
+    return os.path.join(directory, f'{crc:08x}.bin')
+
+# Returns the contents of the chip's ROM with the given CRC32, or None if
+# there's no manifest for them.
+def load_manifest(directory, crc, chip):
+    path = manifest_path(directory, crc)
+    try:
+        with open(path, 'rb') as f:
+            data = f.read()
+    except FileNotFoundError:
+        return None
+    if len(data) != chip.size or binascii.crc32(data) != crc:
+        printv(f'Ignoring {path}, which doesn\'t match its name')
+        return None
+    return data
+
+# Other threads may be saving the same manifest, so each writes its own
+# temporary file, and renames it into place.
+def save_manifest(directory, data):
+    os.makedirs(directory, exist_ok=True)
+    path = manifest_path(directory, binascii.crc32(data))
+    temp = f'{path}.{os.getpid()}.{threading.get_ident()}'
+    with open(temp, 'wb') as f:
+        f.write(data)
+    os.replace(temp, path)
+    printv(f'Saved {path}')
+
+# Returns the page map the arduino would send for the chip holding data.
+def data_pagemap(data, chip):
+    size = chip.page_size
+    return [binascii.crc_hqx(data[p * size:(p + 1) * size], 0) for p in range(chip.page_count)]
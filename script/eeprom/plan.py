@@ -0,0 +1,128 @@
+# Works out the quickest way to get the image onto the chip:
+#
+#   rewrite       send every page, and let the arduino skip the ones that match
+#   incremental   send only the pages the page map says have changed
+#   erase         erase the whole chip, then send the pages that aren't 0xFF
+#
+# When most of the chip changes, a single chip erase and then writing only the
+# pages with something in them beats a write cycle for every page.
+#
+# The estimates are rough. Sending and writing overlap when frames are
+# windowed, so then each plan costs whichever of them takes longer.
+
+import binascii
+import copy
+
+from dataclasses import dataclass
+
+from .image import Image, Page, image_records, with_fills
+from .log import printn
+from .protocol import encode_record, get_checksum
+
+# See eb_chipErase.
+ERASE_SECS = 0.025
+
+PLANS = ['incremental', 'rewrite', 'erase']
+
+# The ones auto picks between. By the time there's a choice we have the page
+# map, and rewrite sends every page incremental does and more, so it never
+# comes out quicker. It's only there to ask for, to have the arduino check
+# every page itself.
+AUTO_PLANS = ['incremental', 'erase']
+
+@dataclass
+class Plan:
+    name: str
+    # What to write, and the page map to skip pages with, if any. For erase,
+    # that includes pages outside the file that need putting back.
+    image: dict
+    pagemap: list
+    pages: int
+    secs: float
+
+    def describe(self):
+        return f'{self.name}, {self.pages} page writes, about {self.secs:.1f}s'
+
+# Seconds to send the records and write pages of them. The link is copied so
+# encoding doesn't use up sequence numbers.
+def estimate_secs(f, pages, link, baud, twc_us):
+    probe = copy.copy(link)
+    sent = with_fills(f) if link.packed else f
+    wire_bytes = sum(len(encode_record(r, 'W', probe)[1]) for r in sent.records)
+    send_secs = wire_bytes * 10 / baud
+    write_secs = pages * twc_us / 1000000
+    return max(send_secs, write_secs) if link.window > 1 else send_secs + write_secs
+
+# The image to write after erasing the chip: every page that won't be all
+# 0xFF, including ones outside the file, which have to come from rom or be
+# blank already according to the page map. Returns None if erasing would lose
+# something.
+def erased_image(image, pagemap, rom):
+    size = image.chip.page_size
+    erased = bytes([0xff]) * size
+    result = Image(image.chip)
+    for page_num in range(image.chip.page_count):
+        page = image.get(page_num)
+        if page is not None:
+            if not all(page.covered):
+                return None
+            data = bytes(page.data)
+        elif rom is not None:
+            data = rom[page_num * size:(page_num + 1) * size]
+        elif pagemap[page_num] == binascii.crc_hqx(erased, 0):
+            continue
+        else:
+            return None
+        if data != erased:
+            result[page_num] = Page(bytearray(data), [True] * size)
+    return result
+
+# Returns the plans that are possible, incremental first. Erasing isn't, if
+# the chip can't, or there are pages outside the file we don't know are blank
+# or what they hold.
+def make_plans(image, pagemap, rom, link, baud, twc_us):
+    changed = image_records(image, pagemap)
+    pages = len({ r.address >> image.chip.page_bits for r in changed.records })
+    plans = [
+        Plan('incremental', image, pagemap, pages, estimate_secs(changed, pages, link, baud, twc_us)),
+        Plan('rewrite', image, None, pages, estimate_secs(image_records(image), pages, link, baud, twc_us)),
+    ]
+    erase = erased_image(image, pagemap, rom) if image.chip.erase else None
+    if erase is not None:
+        pages = len(erase)
+        secs = ERASE_SECS + estimate_secs(image_records(erase), pages, link, baud, twc_us)
+        plans.append(Plan('erase', erase, None, pages, secs))
+    return plans
+
+# Returns the plan to use: the one asked for, or the quickest of AUTO_PLANS.
+# Prints them all.
+def choose_plan(plans, name):
+    for plan in plans:
+        printn(f'Plan {plan.describe()}')
+    if name == 'auto':
+        return min((plan for plan in plans if plan.name in AUTO_PLANS), key=lambda plan: plan.secs)
+    for plan in plans:
+        if plan.name == name:
+            return plan
+    raise RuntimeError(f'Can\'t use the {name} plan here')
+
+# The page map says which pages outside the file are blank, but a CRC16 isn't
+# much to go on before wiping the chip. Checks each run of them with a CRC32
+# instead. Returns False if any turn out not to be, or the arduino can't say.
+def confirm_erased(port, image, rom):
+    if rom is not None:
+        return True
+    size = image.chip.page_size
+    runs = []
+    for page_num in range(image.chip.page_count):
+        if page_num in image:
+            continue
+        if runs and runs[-1][1] == page_num:
+            runs[-1][1] += 1
+        else:
+            runs.append([page_num, page_num + 1])
+    for (first, end) in runs:
+        if get_checksum(port, first * size, (end - first) * size) != \
+                binascii.crc32(bytes([0xff]) * ((end - first) * size)):
+            return False
+    return True
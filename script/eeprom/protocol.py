@@ -0,0 +1,489 @@
+# The serial protocol, see src/main.cpp. Everything here takes a
+# transport.Connection, or anything else with serial.Serial's read, readline
+# and write.
+
+import binascii
+import re
+import struct
+import time
+
+from collections import deque
+from dataclasses import dataclass
+
+from .chips import Chip
+from .image import ROM, Fill, complete_page, s1_line
+from .log import device, printn, printv
+
+# We raise this exception if we get a RESET response from the arduino. That
+# means the arduino was resetting, and has just come back up. When we detect
+# that condition, we call `stty -F $PORT -hupcl` to fix it for next time, then
+# start the BEGIN sequence afresh.
+class ResetException(Exception):
+    pass
+
+@dataclass
+class DataResponse:
+    address: int
+    size: int
+
+def check_page(expected, match):
+    got = DataResponse(int(match[2], 16), int(match[3]))
+    if expected.size != got.size:
+        raise RuntimeError(f'Expected {expected.size} bytes, got {got.size}')
+    if expected.address != got.address:
+        raise RuntimeError(f'Expected address 0x{expected.address:x} , got 0x{got.address:x}')
+
+def check_seq(expected, match):
+    if match[4] is not None and int(match[4]) != expected:
+        raise RuntimeError(f'Expected sequence {expected}, got {match[4]}')
+
+# Returns the next ACK. If data_prefix is given, lines starting with it are
+# returned as well.
+def get_response(port, data_prefix=None):
+    while True:
+        response = str(port.readline(), 'ascii').rstrip()
+        if len(response) == 0:
+            printv(f'<-- []')
+            continue
+        printv(f'<-- {response}')
+        if "MSG:" in response:
+            printn(response)
+            continue
+        if "ACK:" in response:
+            return response
+        if data_prefix is not None and response.startswith(data_prefix):
+            return response
+        if "NAK:" in response:
+            raise RuntimeError(response)
+        if response == 'RESET':
+            raise ResetException
+        raise RuntimeError(f'Unexpected response: {response}')
+
+def expect(port, regex, description, data_prefix=None):
+    response = get_response(port, data_prefix)
+    match = re.match(regex, response)
+    if match is None:
+        raise RuntimeError(f'Unexpected {description} response: {response}')
+    return match
+
+def expect_ack(port, ack):
+    response = get_response(port)
+    if response != 'ACK:' + ack:
+        raise RuntimeError(f'Expected ACK:{ack}, got: {response}')
+    return
+
+def send(port, string):
+    printv(f'--> {string}')
+    port.write((string + '\n').encode('ascii'))
+
+# Binary page frame, see src/frame.h:
+#   STX len op seq addrHigh addrLow data... crcHigh crcLow
+# len covers op, seq, address and data. The CRC16 (XMODEM) covers the same
+# bytes.
+FRAME_START = 0x02
+
+def encode_frame(op, seq, address, data):
+    body = struct.pack('>cBH', op.encode('ascii'), seq, address) + data
+    crc = binascii.crc_hqx(body, 0)
+    return struct.pack('BB', FRAME_START, len(body)) + body + struct.pack('>H', crc)
+
+# How we talk to the arduino, as negotiated after BEGIN.
+@dataclass
+class Link:
+    binary: bool = False
+    window: int = 1
+    packed: bool = False
+    force: bool = False
+    seq: int = 0
+
+    def next_seq(self):
+        seq = self.seq
+        self.seq = (self.seq + 1) & 0xff
+        return seq
+
+# Ask the arduino to accept binary page frames. Older firmware doesn't know
+# the BINARY command and NAKs it, in which case we stay with SREC lines.
+def negotiate_binary(port):
+    send(port, 'BINARY')
+    try:
+        expect_ack(port, 'BINARY')
+        return True
+    except RuntimeError as e:
+        printv(f'Binary mode not available ({e}), using SREC lines')
+        return False
+
+# Ask for up to `window` frames in flight at once. The arduino replies with
+# how many it can actually cope with.
+def negotiate_window(port, window):
+    send(port, f'WINDOW {window}')
+    try:
+        match = expect(port, r'^ACK:WINDOW:(\d+)$', 'window response')
+        return int(match[1])
+    except RuntimeError as e:
+        printv(f'Windowing not available ({e}), sending one page at a time')
+        return 1
+
+# Ask whether the arduino takes packed (Z) frames and FILL. Older firmware
+# NAKs this, and gets plain frames.
+def negotiate_packed(port):
+    send(port, 'PACKED')
+    try:
+        expect_ack(port, 'PACKED')
+        return True
+    except RuntimeError as e:
+        printv(f'Packed frames not available ({e}), sending pages as they are')
+        return False
+
+# Ask whether the arduino takes F ops, which write without checking the page
+# first. Older firmware NAKs this, and gets W ops.
+def negotiate_force(port):
+    send(port, 'FORCE')
+    try:
+        expect_ack(port, 'FORCE')
+        return True
+    except RuntimeError as e:
+        printv(f'Forced writes not available ({e}), checking every page')
+        return False
+
+# PackBits, see src/frame.h. Runs of three or more bytes are repeated, the
+# rest goes as literals.
+def packbits(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        run = 1
+        while i + run < len(data) and run < 128 and data[i + run] == data[i]:
+            run += 1
+        if run >= 3:
+            out += bytes([257 - run, data[i]])
+            i += run
+            continue
+        start = i
+        while i < len(data) and i - start < 128:
+            if i + 2 < len(data) and data[i] == data[i + 1] == data[i + 2]:
+                break
+            i += 1
+        out += bytes([i - start - 1]) + data[start:i]
+    return bytes(out)
+
+# Encodes the page as a Z frame if that's shorter.
+def encode_page_frame(op, seq, record, packed):
+    if packed:
+        payload = op.encode('ascii') + packbits(record.data)
+        if len(payload) < record.size:
+            return encode_frame('Z', seq, record.address, payload)
+    return encode_frame(op, seq, record.address, record.data)
+
+# Returns the sequence number for the record, if it gets one, and the bytes
+# that send it: a FILL command, a frame or an SREC line.
+def encode_record(record, op, link):
+    if isinstance(record, Fill):
+        return (None, f'FILL {record.address:X} {record.size:X} {record.value:X}\n'.encode('ascii'))
+    if not link.binary:
+        return (None, (op + s1_line(record) + '\n').encode('ascii'))
+    seq = link.next_seq()
+    return (seq, encode_page_frame(op, seq, record, link.packed))
+
+# The rates --baud auto tries, fastest first. These are the ones a 16 MHz
+# arduino can hit exactly.
+BAUD_RATES = [2000000, 1000000, 500000, 250000]
+
+# How long the arduino waits for SYNC at a new rate before going back to the
+# old one. See c_baudSyncMillis.
+BAUD_SYNC_SECS = 1.0
+
+# Sends SYNC and waits a short while for the ACK. Anything else, including
+# garbage at the wrong rate, is ignored.
+def sync(port, timeout=0.5):
+    port.reset_input_buffer()
+    send(port, 'SYNC')
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        response = port.readline().rstrip()
+        printv(f'<-- {response}')
+        if response == b'ACK:SYNC':
+            return True
+    return False
+
+# Tries each rate in turn, and returns the one we end up at. If the arduino
+# NAKs a rate, or we can't SYNC at it, we wait for the arduino to give up and
+# go back to the default rate, then try the next.
+def negotiate_baud(port, rates):
+    default = port.baudrate
+    for rate in rates:
+        send(port, f'BAUD {rate}')
+        try:
+            expect(port, r'^ACK:BAUD:(\d+)$', 'baud response')
+        except RuntimeError as e:
+            printv(f'Baud rate {rate} not available ({e})')
+            continue
+        port.baudrate = rate
+        if sync(port):
+            printv(f'Switched to {rate} baud')
+            return rate
+        printn(f'No response at {rate} baud, going back to {default}')
+        port.baudrate = default
+        time.sleep(BAUD_SYNC_SECS)
+        if not sync(port, BAUD_SYNC_SECS):
+            raise RuntimeError(f'Lost contact after trying {rate} baud')
+    return default
+
+# Returns a list with the CRC16 of every page in the chip's ROM, or None if
+# the arduino doesn't support PAGEMAP.
+def get_pagemap(port, chip):
+    send(port, 'PAGEMAP')
+    crcs = []
+    try:
+        while True:
+            response = get_response(port, 'MAP:')
+            if response == 'ACK:PAGEMAP':
+                break
+            match = re.match(r'^MAP:([0-9A-F]{4}):((?:[0-9A-F]{4})+)$', response)
+            if match is None or int(match[1], 16) != len(crcs):
+                raise RuntimeError(f'Unexpected page map response: {response}')
+            crcs += [int(match[2][i:i+4], 16) for i in range(0, len(match[2]), 4)]
+    except RuntimeError as e:
+        printv(f'Page map not available ({e}), sending every page')
+        return None
+    if len(crcs) != chip.page_count:
+        raise RuntimeError(f'Expected {chip.page_count} page CRCs, got {len(crcs)}')
+    return crcs
+
+# Passed to the progress callback after each ACK, or chunk of a READ. op says
+# what happened: W written, V already matched, F a FILL that wrote something,
+# . one that didn't, < data read.
+@dataclass
+class Progress:
+    verb: str
+    done: int
+    total: int
+    op: str
+    elapsed: float
+
+# Reads size bytes of the ROM from start. The arduino sends a DATA line, then
+# the raw bytes, then an ACK.
+def read_rom(port, start, size, progress=None):
+    send(port, f'READ {start:X} {size:X}')
+    match = expect(port, r'^DATA:([0-9A-F]+)$', 'read response', 'DATA:')
+    if int(match[1], 16) != size:
+        raise RuntimeError(f'Expected {size} bytes, arduino is sending {match[1]}')
+    data = bytearray()
+    begin = time.monotonic()
+    while len(data) < size:
+        chunk = port.read(size - len(data))
+        if len(chunk) == 0:
+            raise RuntimeError(f'Timed out after reading {len(data)} of {size} bytes')
+        data += chunk
+        if progress is not None:
+            progress(Progress('Reading', len(data), size, '<', time.monotonic() - begin))
+    expect_ack(port, 'READ')
+    return bytes(data)
+
+# Prints the arduino's running totals, as name=value pairs. These survive
+# across sessions, so they're worth logging to spot a chip or link going bad.
+def report_counters(port):
+    send(port, 'STATS')
+    try:
+        match = expect(port, r'^ACK:STATS:(.*)$', 'stats response')
+    except RuntimeError as e:
+        printv(f'Firmware counters not available ({e})')
+        return
+    printn(f'Counters: {match[1]}')
+
+# Returns the CRC32 of size bytes of the ROM from start, as computed by the
+# arduino, or None if it doesn't support CHECKSUM.
+def get_checksum(port, start, size):
+    send(port, f'CHECKSUM {start:X} {size:X}')
+    try:
+        match = expect(port, r'^ACK:CHECKSUM:([0-9A-F]{8})$', 'checksum response')
+    except RuntimeError as e:
+        printv(f'Checksum not available ({e}), verifying every page')
+        return None
+    return int(match[1], 16)
+
+# Splits the records into lists of ones that follow on from each other.
+def contiguous_runs(records):
+    runs = []
+    for record in records:
+        if runs and runs[-1][-1].address + runs[-1][-1].size == record.address:
+            runs[-1].append(record)
+        else:
+            runs.append([record])
+    return runs
+
+# Checks the records against the ROM with a CHECKSUM for each run of
+# contiguous records. Returns the records that still need verifying page by
+# page: those in runs that didn't match, or all of them if the arduino can't
+# do CHECKSUM.
+def unverified_records(port, f):
+    records = []
+    for run in contiguous_runs(f.records):
+        start = run[0].address
+        data = b''.join(r.data for r in run)
+        crc = get_checksum(port, start, len(data))
+        if crc is None:
+            return f
+        if crc != binascii.crc32(data):
+            printn(f'Checksum mismatch in 0x{start:04x}-0x{start + len(data) - 1:04x}')
+            records += run
+    return ROM(sum(r.size for r in records), len(records), records, f.chip)
+
+# Returns the chip the firmware was built for, as INFO describes it, or None
+# if it's too old to say.
+def get_info(port):
+    send(port, 'INFO')
+    try:
+        match = expect(port, r'^ACK:INFO:(.*)$', 'info response')
+    except RuntimeError as e:
+        printv(f'Chip info not available ({e})')
+        return None
+    info = dict(field.split('=', 1) for field in match[1].split(',') if '=' in field)
+    try:
+        chip = Chip(info['chip'], int(info['size']), int(info['page']).bit_length() - 1,
+                    int(info['twc']), info['erase'] == '1')
+    except (KeyError, ValueError):
+        raise RuntimeError(f'Unexpected info response: {match[0]}')
+    if chip.size > 0x8000:
+        raise RuntimeError(f'The arduino is built for a {chip.name}, which is bigger than the 32K it can address')
+    return chip
+
+# Returns the number of pages written this session, the min, average and max
+# write cycle times in microseconds, and the average from the last session
+# that wrote anything. Older firmware gives zeros for what it doesn't know.
+def get_write_cycles(port):
+    send(port, 'TWC')
+    try:
+        match = expect(port, r'^ACK:TWC:(\d+):(\d+):(\d+):(\d+)(?::(\d+))?$', 'write cycle response')
+    except RuntimeError as e:
+        printv(f'Write cycle times not available ({e})')
+        return (0, 0, 0, 0, 0)
+    return tuple(int(m or 0) for m in match.groups())
+
+# Reports the write cycle times the arduino has seen this session.
+def report_write_cycles(port):
+    (pages, min_us, avg_us, max_us, _) = get_write_cycles(port)
+    if pages > 0:
+        printn(f'Write cycle: {pages} pages, min {min_us} us, avg {avg_us} us, max {max_us} us')
+
+# The receive_*_ack functions return what happened, as in Progress.op.
+def receive_page_ack(port, seq, record):
+    match = expect(port, r'^ACK:([WV]):([0-9A-Z]+):(\d+)(?::(\d+))?(?: T=([\d,]+))?$', 'page response')
+    check_page(record, match)
+    check_seq(seq, match)
+    if device.stats is not None:
+        device.stats.add_page(record.size, match[5])
+    return match[1]
+
+def receive_fill_ack(port, fill):
+    match = expect(port, r'^ACK:FILL:(\d+)$', 'fill response')
+    if device.stats is not None:
+        device.stats.add_page(fill.size, None)
+    return 'F' if int(match[1]) > 0 else '.'
+
+def receive_ack(port, seq, record):
+    if isinstance(record, Fill):
+        return receive_fill_ack(port, record)
+    return receive_page_ack(port, seq, record)
+
+# Fills in the gaps in partial pages with what's in the ROM already, so they
+# can go as a single page write. Older firmware can't READ, in which case the
+# partial pages stay as they are.
+def fill_image_from_rom(port, image):
+    for (page_num, page) in sorted(image.items()):
+        if all(page.covered):
+            continue
+        try:
+            rom = read_rom(port, page_num << image.chip.page_bits, image.chip.page_size)
+        except RuntimeError as e:
+            printv(f'Can\'t read partial pages ({e}), sending them in pieces')
+            return
+        complete_page(page, rom)
+
+# NAKs for getting a record across, rather than for what it asked for. The
+# record can be sent again, once the arduino is listening for it.
+LINK_ERRORS = ['Invalid frame', 'Invalid packed frame', 'Frame out of sequence', 'Invalid srecord',
+               'Serial read timeout', 'Buffer overrun']
+
+# How many times the same record is sent again before giving up.
+MAX_RESENDS = 3
+
+def is_link_error(e):
+    return any(str(e).startswith('NAK:' + error) for error in LINK_ERRORS)
+
+# After a record didn't get across, waits for the arduino to answer or drop
+# everything else that was in flight. In binary mode, BINARY then resets the
+# sequence, so the first frame sent again is the one it's expecting.
+def resync(port, link):
+    port.drain()
+    while port.readline() != b'':
+        pass
+    if link.binary:
+        send(port, 'BINARY')
+        expect_ack(port, 'BINARY')
+        link.seq = 0
+
+# Send each record, keeping up to link.window of them in flight. With a window
+# of one this is plain stop-and-wait. The records are all encoded up front, so
+# each ACK can be answered with the next record straight away. Returns the
+# number of records that wrote something. If force is set, the pages are known
+# to have changed, and go as F ops if the arduino takes them. If there's a
+# journal, each record is noted in it as it goes and as it's ACKed.
+#
+# If a record is NAKed for not getting across, as with a glitch on the line,
+# everything in flight behind it is lost too. That record and the rest are
+# sent again, up to MAX_RESENDS times, before giving up with the first error.
+def send_file(f, port, verify, link, progress=None, force=False, journal=None):
+    verb = "Verifying" if verify else "Writing"
+    op = "V" if verify else "F" if force and link.force else "W"
+    printn(f'{verb} {f.size} bytes in {f.pages} pages')
+    if device.stats is not None:
+        device.stats.begin_pass(f.size)
+    pending = deque((record, encode_record(record, op, link)) for record in f.records)
+    begin = time.monotonic()
+    updated = 0
+    done = 0
+    in_flight = deque()
+    resends = 0
+
+    def receive():
+        nonlocal updated, done
+        (record, (seq, _)) = in_flight[0]
+        result = receive_ack(port, seq, record)
+        in_flight.popleft()
+        if journal is not None:
+            journal.acked(record, result)
+        if result in 'WF':
+            updated += 1
+        done += record.size
+        if progress is not None:
+            progress(Progress(verb, done, f.size, result, time.monotonic() - begin))
+
+    while pending or in_flight:
+        if pending and len(in_flight) < link.window:
+            (record, (seq, data)) = pending.popleft()
+            if isinstance(record, Fill):
+                printv(f'--> FILL address=0x{record.address:x} size={record.size} value=0x{record.value:x}')
+            else:
+                printv(f'--> {op} address=0x{record.address:x} size={record.size} seq={seq}')
+            if journal is not None:
+                journal.sent(record)
+            port.write(data)
+            in_flight.append((record, (seq, data)))
+            continue
+        try:
+            receive()
+            resends = 0
+        except RuntimeError as e:
+            if not is_link_error(e) or resends == MAX_RESENDS:
+                raise
+            resends += 1
+            printn(f'{e}, sending again from 0x{in_flight[0][0].address:04x}')
+            resync(port, link)
+            # Everything not ACKed yet goes again, numbered from the new
+            # sequence
+            records = [record for (record, _) in in_flight + pending]
+            in_flight.clear()
+            pending = deque((record, encode_record(record, op, link)) for record in records)
+    if device.stats is not None:
+        device.stats.end_pass(verb)
+    return updated
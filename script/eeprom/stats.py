@@ -0,0 +1,59 @@
+# Where the time went, for --stats.
+
+import time
+
+from .log import print_lock, printn
+
+# Collects the phase times the arduino appends to page ACKs after TIMING ON,
+# and the overall transfer rate. See src/main.cpp for the phases.
+PHASES = ['receive', 'parse', 'verify', 'load', 'wait']
+
+class Stats:
+    def __init__(self):
+        self.times = { phase: [] for phase in PHASES }
+        self.begin_pass(0)
+
+    def begin_pass(self, size):
+        self.start = time.monotonic()
+        self.size = size
+        self.done = 0
+
+    def add_page(self, size, times):
+        self.done += size
+        if times is not None:
+            for (phase, us) in zip(PHASES, times.split(',')):
+                self.times[phase].append(int(us))
+
+    def rate(self):
+        elapsed = time.monotonic() - self.start
+        return self.done / elapsed if elapsed > 0 else 0
+
+    def end_pass(self, verb):
+        elapsed = time.monotonic() - self.start
+        printn(f'{verb} took {elapsed:.1f}s, {self.rate():.0f} bytes/sec')
+
+    # Prints a line per phase, followed by its histogram, with power of two
+    # buckets.
+    def report(self):
+        if not any(self.times.values()):
+            return
+        with print_lock:
+            self.print_report()
+
+    def print_report(self):
+        printn(f'{"Phase (us)":12} {"count":>7} {"min":>7} {"avg":>7} {"max":>7}')
+        for phase in PHASES:
+            times = self.times[phase]
+            if len(times) == 0:
+                continue
+            printn(f'{phase:12} {len(times):7} {min(times):7} {sum(times) // len(times):7} {max(times):7}')
+            buckets = {}
+            for us in times:
+                bucket = us.bit_length()
+                buckets[bucket] = buckets.get(bucket, 0) + 1
+            most = max(buckets.values())
+            for (bucket, count) in sorted(buckets.items()):
+                low = (1 << bucket) >> 1
+                high = (1 << bucket) - 1
+                bar = '#' * max(1, count * 40 // most)
+                printn(f'    {low:6}-{high:<6} {bar} {count}')
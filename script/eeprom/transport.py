@@ -0,0 +1,195 @@
+# A serial port with a thread at each end. The writer takes pre-encoded
+# commands and frames off a queue, so the caller never waits for the port to
+# drain, and the reader keeps the port's input empty, so replies pile up here
+# rather than in the OS. The protocol code reads and writes it like a
+# serial.Serial.
+#
+# A Recorder can be attached to keep a transcript of the session, in the form
+# src/native/replay.cpp replays against main.cpp.
+
+import queue
+import threading
+import time
+
+class Connection:
+    # How long readline() and read() wait, like serial.Serial's timeout.
+    timeout = 1.0
+
+    # How often the reader thread checks whether we're closing.
+    POLL_SECS = 0.05
+
+    def __init__(self, port, recorder=None):
+        self.port = port
+        self.recorder = recorder
+        self.port.timeout = self.POLL_SECS
+        self.received = bytearray()
+        self.ready = threading.Condition()
+        self.outgoing = queue.Queue()
+        self.error = None
+        self.closing = False
+        self.reader = threading.Thread(target=self.read_loop, daemon=True)
+        self.writer = threading.Thread(target=self.write_loop, daemon=True)
+        self.reader.start()
+        self.writer.start()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    # Waits for everything queued to be sent, then stops both threads. The
+    # port is left open.
+    def close(self):
+        if self.closing:
+            return
+        self.outgoing.put(None)
+        self.writer.join()
+        self.closing = True
+        self.reader.join()
+        if self.recorder is not None:
+            self.recorder.close()
+
+    def read_loop(self):
+        while not self.closing:
+            try:
+                data = self.port.read(max(1, self.port.in_waiting))
+            except Exception as e:
+                with self.ready:
+                    self.error = e
+                    self.ready.notify_all()
+                return
+            if data:
+                if self.recorder is not None:
+                    self.recorder.received(data)
+                with self.ready:
+                    self.received += data
+                    self.ready.notify_all()
+
+    def write_loop(self):
+        while True:
+            data = self.outgoing.get()
+            try:
+                if data is not None and self.error is None:
+                    if self.recorder is not None:
+                        self.recorder.sent(data)
+                    self.port.write(data)
+            except Exception as e:
+                with self.ready:
+                    self.error = e
+                    self.ready.notify_all()
+            finally:
+                self.outgoing.task_done()
+            if data is None:
+                return
+
+    def write(self, data):
+        self.outgoing.put(bytes(data))
+
+    # Blocks until the writer thread has sent everything queued so far.
+    def drain(self):
+        self.outgoing.join()
+
+    # Waits up to the timeout for ready(), which is called with the lock held.
+    # Raises the reader's or writer's exception if there was one.
+    def wait_for(self, ready):
+        deadline = time.monotonic() + self.timeout
+        with self.ready:
+            while not ready():
+                if self.error is not None:
+                    raise self.error
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return False
+                self.ready.wait(remaining)
+            return True
+
+    # Returns the next line, including the newline, or b'' if none turns up
+    # in time.
+    def readline(self):
+        if not self.wait_for(lambda: b'\n' in self.received):
+            return b''
+        with self.ready:
+            end = self.received.index(b'\n') + 1
+            line = bytes(self.received[:end])
+            del self.received[:end]
+            return line
+
+    # Returns up to size bytes, as soon as there are any, or b'' if none turn
+    # up in time.
+    def read(self, size):
+        if not self.wait_for(lambda: len(self.received) > 0):
+            return b''
+        with self.ready:
+            data = bytes(self.received[:size])
+            del self.received[:size]
+            return data
+
+    # Throws away anything received but not read yet.
+    def reset_input_buffer(self):
+        with self.ready:
+            self.port.reset_input_buffer()
+            self.received.clear()
+
+    @property
+    def baudrate(self):
+        return self.port.baudrate
+
+    # Anything queued goes at the old rate.
+    @baudrate.setter
+    def baudrate(self, rate):
+        self.drain()
+        self.port.baudrate = rate
+
+# Writes what goes each way to a transcript file, a > line for each write and
+# a < line for each line that comes back. Writes are noted just before they
+# go, so a reply can't be recorded ahead of what it answers.
+class Recorder:
+    def __init__(self, path, comment=None):
+        self.file = open(path, 'w')
+        self.lock = threading.Lock()
+        self.pending = bytearray()
+        if comment is not None:
+            self.file.write(f'# {comment}\n')
+
+    def sent(self, data):
+        with self.lock:
+            self.flush_pending()
+            self.file.write(f'> {escape(data)}\n')
+
+    def received(self, data):
+        with self.lock:
+            self.pending += data
+            while b'\n' in self.pending:
+                end = self.pending.index(b'\n') + 1
+                self.file.write(f'< {escape(self.pending[:end])}\n')
+                del self.pending[:end]
+
+    def close(self):
+        with self.lock:
+            self.flush_pending()
+            self.file.close()
+
+    # A partial line goes out on its own if the host sends something before
+    # the rest arrives.
+    def flush_pending(self):
+        if self.pending:
+            self.file.write(f'< {escape(self.pending)}\n')
+            self.pending.clear()
+
+# Bytes as transcript text: printable ASCII as it is, the rest as \n, \r, \\
+# or \xNN. A trailing space is escaped too, so it can't get lost.
+def escape(data):
+    out = []
+    for i, c in enumerate(data):
+        if c == 0x0a:
+            out.append('\\n')
+        elif c == 0x0d:
+            out.append('\\r')
+        elif c == 0x5c:
+            out.append('\\\\')
+        elif c < 0x20 or c > 0x7e or (c == 0x20 and i == len(data) - 1):
+            out.append(f'\\x{c:02x}')
+        else:
+            out.append(chr(c))
+    return ''.join(out)
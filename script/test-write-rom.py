@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+
+# Runs write-rom.py against main.cpp on pseudo-terminals, with the simulated
+# chip behind each, and checks what the chips end up holding. Build the
+# bridge first:
+#
+#   pio run -e native_pty
+#   script/test-write-rom.py
+#
+# Each test starts its bridges with the chip contents in a file, and reads
+# them back from there once they've exited.
+
+import argparse
+import binascii
+import os
+import random
+import signal
+import subprocess
+import sys
+import tempfile
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, SCRIPT_DIR)
+
+from eeprom.image import Record, s1_line
+
+ROM_SIZE = 32 * 1024
+
+class Bridge:
+    def __init__(self, program, directory, name, exit_after=None, glitch=None):
+        self.rom_path = os.path.join(directory, f'{name}.bin')
+        args = [program, '--rom', self.rom_path, '--link', os.path.join(directory, name)]
+        if exit_after is not None:
+            args += ['--exit-after', str(exit_after)]
+        if glitch is not None:
+            args += ['--glitch', str(glitch)]
+        self.process = subprocess.Popen(args, stdout=subprocess.PIPE, text=True)
+        self.port = self.process.stdout.readline().strip()
+        if not self.port:
+            raise RuntimeError(f'{program} didn\'t start')
+
+    # Stops the bridge, if it hasn't already, and returns what the chip holds.
+    def stop(self):
+        if self.process.poll() is None:
+            self.process.send_signal(signal.SIGTERM)
+        self.process.wait(timeout=10)
+        with open(self.rom_path, 'rb') as f:
+            return f.read()
+
+class Tests:
+    def __init__(self, program, directory):
+        self.program = program
+        self.directory = directory
+        self.failures = 0
+
+    def path(self, name):
+        return os.path.join(self.directory, name)
+
+    def bridge(self, name, exit_after=None, glitch=None):
+        return Bridge(self.program, self.directory, name, exit_after, glitch)
+
+    def write_rom(self, *args):
+        command = [sys.executable, os.path.join(SCRIPT_DIR, 'write-rom.py')] + list(args)
+        result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                text=True, timeout=300)
+        return (result.returncode, result.stdout)
+
+    def check(self, name, ok, output=''):
+        print(f'{name:40} {"ok" if ok else "FAIL"}')
+        if not ok:
+            self.failures += 1
+            print(output)
+
+    # write-rom.py on one bridge. Returns what it printed, and the chip.
+    def burn(self, name, args, expect_ok=True, exit_after=None, glitch=None):
+        bridge = self.bridge(name, exit_after, glitch)
+        (status, output) = self.write_rom('--port', bridge.port, *args)
+        rom = bridge.stop()
+        if (status == 0) != expect_ok:
+            self.check(f'{name}: exit status {status}', False, output)
+        return (output, rom)
+
+def make_images(directory):
+    rng = random.Random(6502)
+    full = bytes(rng.randrange(256) for _ in range(ROM_SIZE))
+    with open(os.path.join(directory, 'full.bin'), 'wb') as f:
+        f.write(full)
+
+    # A few records, some of them only part of a page.
+    records = [Record(0x0000, 16, full[:16]), Record(0x0123, 40, full[0x123:0x123 + 40]),
+               Record(0x4000, 32, bytes([0xea]) * 32), Record(0x7ff0, 16, full[-16:])]
+    with open(os.path.join(directory, 'part.s19'), 'w') as f:
+        for r in records:
+            f.write(s1_line(r) + '\n')
+    return (full, records)
+
+# The chip with one page changed so its CRC16 is the same, which the page map
+# can't tell apart.
+def colliding(rom, page_num):
+    start = page_num * 64
+    page = bytearray(rom[start:start + 64])
+    target = binascii.crc_hqx(page, 0)
+    page[2] ^= 0xff
+    for value in range(0x10000):
+        page[0:2] = value.to_bytes(2, 'big')
+        if binascii.crc_hqx(page, 0) == target:
+            break
+    return rom[:start] + bytes(page) + rom[start + 64:]
+
+def applied(rom, records):
+    data = bytearray(rom)
+    for r in records:
+        data[r.address:r.address + r.size] = r.data
+    return bytes(data)
+
+def run(t):
+    (full, records) = make_images(t.directory)
+    full_bin = t.path('full.bin')
+    part_s19 = t.path('part.s19')
+    blank = bytes([0xff]) * ROM_SIZE
+
+    (output, rom) = t.burn('burn', [full_bin])
+    t.check('burn a whole chip', rom == full, output)
+
+    (output, rom) = t.burn('burn', [full_bin])
+    t.check('burn it again, nothing changed', rom == full and '512 of 512 pages unchanged' in output, output)
+
+    # A bit flipped in a frame partway through, with others in flight behind it
+    (output, rom) = t.burn('glitch', [full_bin], glitch=20000)
+    t.check('a glitch on the line', rom == full and 'sending again' in output, output)
+
+    with open(t.path('collide.bin'), 'wb') as f:
+        f.write(colliding(full, 5))
+    (output, rom) = t.burn('collide', [full_bin])
+    t.check('a page only its CRC16 matches', rom == full and 'mismatch' in output, output)
+
+    (output, rom) = t.burn('burn', ['--baud', 'auto', '--dump', t.path('dump.bin')])
+    with open(t.path('dump.bin'), 'rb') as f:
+        dumped = f.read()
+    t.check('--baud auto --dump', dumped == full and 'baud' in output, output)
+
+    (output, rom) = t.burn('burn', ['--ascii', '--window', '1', part_s19])
+    t.check('SREC lines, stop-and-wait', rom == applied(full, records), output)
+
+    manifests = t.path('manifests')
+    (output, rom) = t.burn('manifest', ['--manifests', manifests, full_bin])
+    t.check('--manifests, new chip', 'No manifest' in output and rom == full, output)
+    (output, rom) = t.burn('manifest', ['--manifests', manifests, part_s19])
+    t.check('--manifests, chip it knows', 'No manifest' not in output
+            and rom == applied(full, records), output)
+
+    # Two sessions on one arduino, the second planning with the write cycle
+    # time the first measured rather than the datasheet's.
+    bridge = t.bridge('twc')
+    t.write_rom('--port', bridge.port, full_bin)
+    (status, output) = t.write_rom('--port', bridge.port, '--verbose', part_s19)
+    bridge.stop()
+    t.check('plans with the measured tWC', status == 0 and 'Planning with a 10000 us' not in output
+            and 'Planning with a' in output, output)
+
+    bridges = [t.bridge(f'multi{i}') for i in range(3)]
+    (status, output) = t.write_rom('--port', ','.join(b.port for b in bridges), full_bin)
+    roms = [b.stop() for b in bridges]
+    t.check('three ports at once', status == 0 and '3 of 3 passed' in output
+            and all(r == full for r in roms), output)
+
+    # Pulling the cable partway, then running it again.
+    journal = t.path('journal')
+    (output, rom) = t.burn('resume', ['--journal', journal, '--no-pagemap', full_bin],
+                           expect_ok=False, exit_after=100)
+    t.check('interrupted burn', rom != full and rom != blank and os.listdir(journal), output)
+    (output, rom) = t.burn('resume', ['--journal', journal, '--no-pagemap', full_bin])
+    t.check('--journal resumes it', rom == full and 'Resuming: 100 of 512' in output
+            and not os.listdir(journal), output)
+
+parser = argparse.ArgumentParser(description='Test write-rom.py against the native pty bridge')
+parser.add_argument('--bridge',
+    default=os.path.join(SCRIPT_DIR, '..', '.pio', 'build', 'native_pty', 'program'),
+    help='The bridge program, from pio run -e native_pty')
+args = parser.parse_args()
+
+if not os.access(args.bridge, os.X_OK):
+    print(f'No bridge at {args.bridge}, run pio run -e native_pty first')
+    sys.exit(1)
+
+with tempfile.TemporaryDirectory() as directory:
+    tests = Tests(os.path.abspath(args.bridge), directory)
+    run(tests)
+print(f'{tests.failures} failed')
+sys.exit(0 if tests.failures == 0 else 1)
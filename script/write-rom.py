@@ -1,202 +1,127 @@
 #!/usr/bin/env python3
 
+# Command line front end for the eeprom package next to it.
+
 import argparse
-import os
-import re
-import serial
 import sys
-
-from dataclasses import dataclass
-
-# We raise this exception if we get a RESET response from the arduino. That
-# means the arduino was resetting, and has just come back up. When we detect
-# that condition, we call `stty -F $PORT -hupcl` to fix it for next time, then
-# start the BEGIN sequence afresh.
-class ResetException(Exception):
-    pass
-
-verbose = False
-
-def printv(string):
-    if verbose:
-        print(string)
-
-def printq(string):
-    if not verbose:
-        print(string, end='', flush=True)
-
-@dataclass
-class DataResponse:
-    address: int
-    size: int
-
-def check_page(expected, match):
-    got = DataResponse(int(match[2], 16), int(match[3]))
-    if expected.size != got.size:
-        raise RuntimeError(f'Expected {expected.size} bytes, got {got.size}')
-    if expected.address != got.address:
-        raise RuntimeError(f'Expected address 0x{expected.address:x} , got 0x{got.address:x}')
-
-def get_response(port):
-    while True:
-        response = str(port.readline(), 'ascii').rstrip()
-        if len(response) == 0:
-            printv(f'<-- []')
-            continue
-        printv(f'<-- {response}')
-        if "MSG:" in response:
-            print(response)
-            continue
-        if "ACK:" in response:
-            return response
-        if "NAK:" in response:
-            raise RuntimeError(response)
-        if response == 'RESET':
-            raise ResetException
-        raise RuntimeError(f'Unexpected response: {response}')
-
-def expect(port, regex, description):
-    response = get_response(port)
-    match = re.match(regex, response)
-    if match is None:
-        raise RuntimeError(f'Unexpected {description} response: {response}')
-    return match
-
-def expect_ack(port, ack):
-    response = get_response(port)
-    if response != 'ACK:' + ack:
-        raise RuntimeError(f'Expected ACK:{ack}, got: {response}')
-    return
-
-def send(port, string):
-    printv(f'--> {string}')
-    port.write(string.encode('ascii'))
-    port.write('\n'.encode('ascii'))
-
-def file_err(line_num, message):
-    raise RuntimeError(f'Line {line_num} {message}')
-
-@dataclass
-class Record:
-    address: int
-    size: int
-    line: bytes
-
-def parse_line(line_num, line):
-    if line[0:2] != 'S1':
-        file_err(line_num, f'doesn\'t look like an SREC S1 record')
-    if len(line) < 10:
-        file_err(line_num, f'is too short ({len(line)}) chars')
-    byte_count = int(line[2:4], 16)
-    if len(line) != (byte_count + 2) * 2:
-        file_err(line_num, f'length doesn\'t match byte count len={len(line)} bc={byte_count}')
-    start_address = int(line[4:8], 16)
-    if start_address >= 32 * 1024:
-        file_err(line_num, f'address 0x{address:x} is outside 32k')
-    size = byte_count - 3
-    if size > 64:
-        file_err(line_num, f'page size {size} is over 64 bytes')
-    end_address = start_address + size - 1
-    start_page = start_address >> 6
-    end_page = end_address >> 6
-    if start_page != end_page:
-        file_err(line_num, f'crosses page boundary')
-    return Record(start_address, size, line)
-
-@dataclass
-class ROM:
-    size: int
-    pages: int
-    records: [Record]
-
-def parse_file(f):
-    size = 0
-    pages = 0
-    records = []
-    for (line_num, line) in enumerate(f):
-        record = parse_line(line_num, line.rstrip())
-        size  += record.size
-        pages += 1
-        records.append(record)
-    return ROM(size, pages, records)
-
-def send_file(f, port, verify):
-    verb = "Verifying" if verify else "Writing"
-    prefix = "V" if verify else "W"
-    print(f'{verb} {f.size} bytes in {f.pages} pages')
-    updated = 0
-    for record in f.records:
-        data = record.line
-        printv(f'Sending page: address=0x{record.address:x} size={record.size}')
-        printq('>\b')
-        send(port, prefix + data)
-        match = expect(port, r'^ACK:([WV]):([0-9A-Z]+):(\d+)$', 'page response')
-        printq('<\b')
-        check_page(record, match)
-        if match[1] == "V":
-            if verify:
-                printq('v')
-            else:
-                printq('.')
-        else:
-            printq('W')
-            updated = updated + 1
-    printq('\n')
-    return updated
+import threading
+
+import eeprom
+from eeprom import log
+from eeprom.log import device, printn
+
+# How often to print progress lines, when there are several devices and no
+# progress characters.
+PROGRESS_SECS = 5
+
+class ProgressState(threading.local):
+    verb = None
+    done = 0
+    acks = 0
+    next_line = 0
+
+progress_state = ProgressState()
+
+# One character per page ACK, or per chunk read, with an ETA every 64 pages
+# for --stats. With several devices the characters would be a jumble, so each
+# prints a percentage every PROGRESS_SECS instead.
+def show_progress(p):
+    state = progress_state
+    if p.verb != state.verb or p.done < state.done:
+        state.verb = p.verb
+        state.acks = 0
+        state.next_line = PROGRESS_SECS
+    state.done = p.done
+    if device.name is not None:
+        if p.elapsed >= state.next_line:
+            printn(f'{p.verb} {p.done * 100 // p.total}%')
+            state.next_line += PROGRESS_SECS
+        return
+    if log.verbose:
+        return
+    state.acks += 1
+    char = 'v' if p.op == 'V' and p.verb == 'Verifying' else '.' if p.op == 'V' else p.op
+    if args.stats and state.acks % 64 == 0 and p.done < p.total:
+        char += f' [{(p.total - p.done) * p.elapsed / p.done:.0f}s] '
+    if p.done == p.total:
+        char += '\n'
+    print(char, end='', flush=True)
 
 parser = argparse.ArgumentParser(description='Write and verify eeprom')
 
 
+parser.add_argument('--ascii',
+    default=False, action="store_true", help='Send SREC lines, not binary frames')
+parser.add_argument('--baud',
+    metavar='RATE', help='Switch to RATE after connecting, or "auto" for the fastest that works')
+parser.add_argument('--chip',
+    default=eeprom.DEFAULT_CHIP.name, choices=eeprom.CHIPS.keys(), help='The chip the file is for, which the arduino must be built for too')
+parser.add_argument('--dump',
+    metavar='FILE', help='Save the ROM contents to FILE before doing anything else')
+parser.add_argument('--base',
+    default=0, type=lambda x: int(x, 0), help='Address the ROM appears at, subtracted from addresses in the file')
 parser.add_argument('--erase',
     default=False, action="store_true", help='Erase chip')
+parser.add_argument('--fill',
+    type=lambda x: int(x, 0), help='Fill the gaps in partial pages with this byte, rather than keeping the ROM contents')
+parser.add_argument('--format',
+    default='auto', choices=['auto', 'srec', 'ihex', 'bin'], help='Format of the file')
+parser.add_argument('--journal',
+    metavar='DIR', help='Keep a journal of each burn in DIR, so one that fails partway can be resumed by running it again. Only saves time with --no-pagemap, or firmware without PAGEMAP, since the page map already skips the pages the last run wrote')
+parser.add_argument('--manifests',
+    metavar='DIR', help='Keep a copy of what each chip holds in DIR, so the next burn only sends the changed pages')
+parser.add_argument('--no-packed',
+    default=False, action="store_true", help='Send every page in full, without packed frames or FILL')
+parser.add_argument('--no-pagemap',
+    default=False, action="store_true", help='Send every page, even unchanged ones')
+parser.add_argument('--plan',
+    default='auto', choices=['auto'] + eeprom.plan.PLANS, help='How to write the file: only the changed pages, every page, or erase first. By default, whichever of incremental and erase looks quickest')
+parser.add_argument('--poll',
+    choices=['toggle', 'data', 'delay'], help='How to detect the end of each write cycle')
 parser.add_argument('--port',
-    default='/dev/ttyUSB0', help='Serial port device')
+    default='/dev/ttyUSB0', help='Serial port device, or several separated by commas or matched by globs, to burn at once')
+parser.add_argument('--record',
+    metavar='FILE', help='Save a transcript of the session to FILE, for the native_replay tests')
 parser.add_argument('--speed',
-    default=115200, type=int, help='Port speed in baud')
+    default=115200, type=int, help='Port speed to connect at, which must match the arduino')
+parser.add_argument('--window',
+    default=8, type=int, help='Maximum number of pages in flight')
+parser.add_argument('--stats',
+    default=False, action="store_true", help='Report where the time went')
 parser.add_argument('--verbose',
     default=False, action="store_true", help='Verbose messages')
 parser.add_argument('file',
-    nargs='?', help='File of S1 records')
+    nargs='?', help='SREC, Intel HEX or binary file to write')
 
 args = parser.parse_args()
-verbose = args.verbose
+log.verbose = args.verbose
+args.chip = eeprom.CHIPS[args.chip]
+options = eeprom.Options(**{ f: getattr(args, f) for f in eeprom.Options.__dataclass_fields__ })
 
 try:
-    with serial.Serial(args.port, args.speed, timeout=1) as port:
-
-        ready = False
-        while not ready:
-            try:
-                send(port, 'BEGIN')
-                expect_ack(port, 'BEGIN')
-                ready = True
-            except ResetException:
-                print("Ignoring RESET, resending BEGIN")
-                # Fix the serial port setup and retry
-                os.system(f'stty -F {args.port} -hupcl')
-
-        if args.erase:
-            send(port, 'ERASE')
-            expect_ack(port, 'ERASE')
-
-        if args.file is not None:
-            with open(args.file) as f:
-                records = parse_file(f)
-                # Send all the records in update mode
-                updated = send_file(records, port, False)
-                # If any got changed, verify them all
-                if updated > 0:
-                    send_file(records, port, True)
-        elif not args.erase:
-            print("No file specified, and not erasing. Nothing to do.")
-
-        send(port, 'END')
-        expect_ack(port, 'END')
-        print("Done")
-
+    ports = eeprom.expand_ports(args.port)
+    if len(ports) > 1 and args.dump is not None:
+        raise RuntimeError('Can only --dump from one port')
+    if len(ports) > 1 and args.record is not None:
+        raise RuntimeError('Can only --record from one port')
+    # Parse the file once, however many ports there are
+    image = None if args.file is None else eeprom.load_image(args.file, args.format, args.base, args.chip)
 except Exception as e:
-    prefix = "NAK:"
-    msg = str(e)
-    msg = msg[len(prefix):] if msg.startswith(prefix) else msg
-    print(msg)
+    print(e)
     sys.exit(1)
+
+if len(ports) == 1:
+    ok = eeprom.burn(ports[0], image, options, show_progress).error is None
+    sys.exit(0 if ok else 1)
+
+(results, elapsed) = eeprom.burn_all(ports, image, options, show_progress)
+width = max(len(p) for p in ports)
+print(f'{"Port":{width}} {"Result":6} {"Bytes":>7} {"Secs":>6}')
+for r in results:
+    error = '' if r.error is None else f'  {r.error}'
+    print(f'{r.port:{width}} {"ok" if r.error is None else "FAIL":6} {r.size:7} {r.elapsed:6.1f}{error}')
+passed = [r for r in results if r.error is None]
+size = sum(r.size for r in passed)
+rate = size / elapsed if elapsed > 0 else 0
+print(f'{len(passed)} of {len(results)} passed, {size} bytes in {elapsed:.1f}s, {rate:.0f} bytes/sec')
+sys.exit(0 if len(passed) == len(results) else 1)
@@ -0,0 +1,53 @@
+#ifndef INCLUDE_CHIPS_H
+#define INCLUDE_CHIPS_H
+
+#include <stdint.h>
+
+// The parts we know how to drive. The firmware is built for one of them,
+// picked with -DEEPROM_CHIP=<ChipId> in platformio.ini, and reports which
+// with INFO. script/eeprom/chips.py has the same table for the host.
+//
+// Nothing bigger than 32K, like the AT28C010, until there's wiring and a
+// protocol for more than 16 address bits.
+enum ChipId {
+    Chip_28C64,             // AT28C64B
+    Chip_28C256,            // AT28C256
+    Chip_28C256_128,        // 28C256 parts with 128 byte pages
+};
+
+#if !defined(EEPROM_CHIP)
+    #define EEPROM_CHIP Chip_28C256
+#endif
+
+struct ChipProfile {
+    const char* name;
+    uint32_t romSize;
+    uint8_t  addressBits;
+    uint8_t  pageBits;
+    uint16_t writeCycleUs;      // tWC, worst case
+    bool     chipErase;         // has the software chip erase sequence
+    uint8_t  eraseMs;           // tEC
+    uint16_t unlock1;           // addresses for the software command sequences
+    uint16_t unlock2;
+    uint8_t  writePulseNops;    // tWP, in 62.5 ns NOPs
+    uint8_t  accessNops;        // tACC, tCE and tOE after the address is set
+};
+
+constexpr ChipProfile c_chips[] = {
+    // name          size         bits page  tWC    erase  tEC  unlock1 unlock2  tWP tACC
+    { "28C64",       8 * 1024UL,   13,  6,   10000, false,  0,  0x1555, 0x0aaa,  2,  3 },
+    { "28C256",      32 * 1024UL,  15,  6,   10000, true,  20,  0x5555, 0x2aaa,  2,  3 },
+    { "28C256-128",  32 * 1024UL,  15,  7,   10000, true,  20,  0x5555, 0x2aaa,  2,  2 },
+};
+
+constexpr ChipProfile c_chip = c_chips[EEPROM_CHIP];
+
+// Addresses are 16 bits all the way from the host to the pins.
+static_assert(c_chip.romSize <= 0x8000, "the boards only have A0-A14 wired up");
+
+const uint8_t  c_pageBits  = c_chip.pageBits;
+const uint8_t  c_pageSize  = 1 << c_pageBits;
+const uint16_t c_romSize   = c_chip.romSize;
+const uint16_t c_pageCount = c_romSize / c_pageSize;
+
+#endif // INCLUDE_CHIPS_H
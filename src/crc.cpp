@@ -0,0 +1,32 @@
+#include "crc.h"
+
+#if defined(__AVR__)
+    #include <util/crc16.h>
+#endif
+
+uint16_t crc16Update(uint16_t crc, uint8_t data) {
+#if defined(__AVR__)
+    return _crc_xmodem_update(crc, data);
+#else
+    crc ^= (uint16_t)data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+#endif
+}
+
+uint16_t crc16(const uint8_t* data, uint16_t size, uint16_t crc) {
+    for (uint16_t i = 0; i < size; i++) {
+        crc = crc16Update(crc, data[i]);
+    }
+    return crc;
+}
+
+uint32_t crc32Update(uint32_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : (crc >> 1);
+    }
+    return crc;
+}
@@ -0,0 +1,18 @@
+#ifndef INCLUDE_CRC_H
+#define INCLUDE_CRC_H
+
+#include <stdint.h>
+
+// CRC16 with the XMODEM parameters (poly 0x1021, initial value 0). This is
+// what python's binascii.crc_hqx(data, 0) computes.
+extern uint16_t crc16Update(uint16_t crc, uint8_t data);
+extern uint16_t crc16(const uint8_t* data, uint16_t size, uint16_t crc = 0);
+
+// CRC32 as used by zip and ethernet, which is python's binascii.crc32(data).
+// Start with c_crc32Initial, feed each byte through crc32Update, then pass the
+// result through crc32Final.
+const uint32_t c_crc32Initial = 0xffffffff;
+extern uint32_t crc32Update(uint32_t crc, uint8_t data);
+inline uint32_t crc32Final(uint32_t crc) { return ~crc; }
+
+#endif // INCLUDE_CRC_H
@@ -9,15 +9,36 @@
 #define CLEAR_PORT_BIT(port, mask)      (PORT_OUT(port) &= ~(mask))
 #define WRITE_MASKED(reg, value, mask)  (reg) = ((reg) & ~(mask)) | (value)
 
-#define NOP __asm__ __volatile__ ("nop\n\t") // 65 ns @ 16 MHz
+#if defined(NATIVE)
+    #define NOP sim_advance(1) // the simulated clock is 16 MHz too
+#else
+    #define NOP __asm__ __volatile__ ("nop\n\t") // 65 ns @ 16 MHz
+#endif
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Count NOPs, for the bus timings that depend on the chip. See ChipProfile.
+template <uint8_t Count>
+static ALWAYS_INLINE void nops() {
+    NOP;
+    nops<Count - 1>();
+}
+
+template <>
+ALWAYS_INLINE void nops<0>() { }
 
 static bool s_busCaptured = false;
+static ebPollHook* s_pollHook = NULL;
+static ebPollMode s_pollMode = ebPollMode_Toggle;
+static ebWriteCycleStats s_writeCycleStats;
+static ebPageTiming s_pageTiming;
+static ebCounters s_counters;
 
 static void releaseBus(bool doReset);
 static void captureBus();
 
 #if !defined(IN_CIRCUIT_6502)
-    static void releaseBus(bool doReset)    { }
+    static void releaseBus(bool)            { }
     static void captureBus()                { }
 #endif
 
@@ -63,6 +84,13 @@ static void captureBus();
         PORT_OUT(ADDR_HIGH) = addrHigh;
     }
 
+    // The address pins change as soon as they're written, so there's nothing
+    // to overlap. beginAddress just keeps the address for endAddress to set.
+    // See the nano section.
+    static uint16_t s_pendingAddress;
+    static void beginAddress(uint16_t address)  { s_pendingAddress = address; }
+    static void endAddress()                    { setAddress(s_pendingAddress); }
+
     static uint8_t readData() {
         return PORT_IN(DATA);
     }
@@ -88,6 +116,15 @@ static void captureBus();
         }
     }
 
+    // Bus access for the full page kernels. See PageBus in the nano section.
+    static uint8_t s_pendingAddrLow;
+    struct PageBus {
+        void beginAddressLow(uint8_t addrLow) const { s_pendingAddrLow = addrLow; }
+        void endAddressLow() const                  { PORT_OUT(ADDR_LOW) = s_pendingAddrLow; }
+        void writeData(uint8_t data) const          { PORT_OUT(DATA) = data; }
+        uint8_t readData() const                    { return PORT_IN(DATA); }
+    };
+
 #elif defined(ARDUINO_AVR_NANO)
 
     #include <avr/io.h>
@@ -172,43 +209,66 @@ static void captureBus();
     const uint8_t Control_OE = PC1_ROM_OEB;
     const uint8_t Control_WE = PC0_ROM_WEB;
 
-    static uint8_t spiSend(uint8_t data) {
+    static void spiStart(uint8_t data) {
         SPDR = data;
+    }
+
+    static void spiWait() {
         while ((SPSR & BIT(SPIF)) == 0) {
             // wait for SPIF
         }
+    }
+
+    static uint8_t spiSend(uint8_t data) {
+        spiStart(data);
+        spiWait();
         return data;
     }
 
+    // Shifting a byte out takes 8 us at 1 MHz, which is longer than the rest
+    // of a byte load or read put together. The SRs keep driving the old
+    // address until RCLK is strobed, so beginAddress starts the shift and
+    // returns, and the caller does the data I/O for the old address while it
+    // goes. endAddress waits for the shift to finish and latches the new one.
+    // There must be an endAddress for every beginAddress, before anything
+    // else touches SPDR.
     static uint8_t s_chipSelectMask = 0;
     static uint8_t s_prevAddrHigh = 0xff;
-    static void setAddress(uint16_t address) {
+    static uint8_t s_pendingRclk = 0;
+    static void beginAddress(uint16_t address) {
         uint8_t addrLow  = address & 0x00ff;
         uint8_t addrHigh = (address >> 8) | s_chipSelectMask;
 
-        uint8_t rclk;
-
         if (s_prevAddrHigh == addrHigh) {
-            // High bits don't change, so no need to set them.
-            spiSend(addrLow);
-
-            // Only strobe the low SR
-            rclk = PC3_SR_RCLK1;
+            // High bits don't change, so no need to set them. Only strobe
+            // the low SR.
+            s_pendingRclk = PC3_SR_RCLK1;
         }
         else {
-            // High byte first
+            // High byte first, and that one has to finish before the low
+            // byte can start.
             spiSend(addrHigh);
-            spiSend(addrLow);
 
             // Strobe both SRs
-            rclk = PC3_SR_RCLK1 | PC4_SR_RCLK2;
+            s_pendingRclk = PC3_SR_RCLK1 | PC4_SR_RCLK2;
 
             s_prevAddrHigh = addrHigh;
         }
 
+        spiStart(addrLow);
+    }
+
+    static void endAddress() {
+        spiWait();
+
         // Strobe the SR_RCLK pins.
-        SET_PORT_BIT(C, rclk);
-        CLEAR_PORT_BIT(C, rclk);
+        SET_PORT_BIT(C, s_pendingRclk);
+        CLEAR_PORT_BIT(C, s_pendingRclk);
+    }
+
+    static void setAddress(uint16_t address) {
+        beginAddress(address);
+        endAddress();
     }
 
     static uint8_t readData() {
@@ -243,6 +303,41 @@ static void captureBus();
         setAddress(address);
     }
 
+    // Bus access for the full page kernels. A page never crosses a 256 byte
+    // boundary, so once setChipSelect has latched the high address byte,
+    // only the low byte needs shifting out, and only SR1 needs strobing.
+    // The low byte is pipelined like beginAddress and endAddress.
+    // The non-data bits of the data ports don't change during a page either,
+    // so they're read once here rather than for every byte.
+    struct PageBus {
+        uint8_t portB;
+        uint8_t portD;
+
+        PageBus()
+            : portB(PORT_OUT(B) & ~PB_DataMask)
+            , portD(PORT_OUT(D) & ~PD_DataMask) { }
+
+        void beginAddressLow(uint8_t addrLow) const {
+            spiStart(addrLow);
+        }
+
+        void endAddressLow() const {
+            spiWait();
+            SET_PORT_BIT(C, PC3_SR_RCLK1);
+            CLEAR_PORT_BIT(C, PC3_SR_RCLK1);
+        }
+
+        void writeData(uint8_t data) const {
+            PORT_OUT(B) = portB | (data & PB_DataMask);
+            PORT_OUT(D) = portD | (data & PD_DataMask);
+        }
+
+        uint8_t readData() const {
+            return (PORT_IN(B) & PB_DataMask)
+                 | (PORT_IN(D) & PD_DataMask);
+        }
+    };
+
     static void initPins() {
         // Set the MOSI and SCK pins to output-low, the reset to hi-z.
         WRITE_MASKED(PORT_OUT(B), 0, PB_MASK);
@@ -348,29 +443,183 @@ static void captureBus();
         }
     }
 
+#elif defined(NATIVE)
+
+    // Host build. Rather than port registers, these drive the simulated
+    // AT28C256 in native/sim28c256.h. Each one advances the simulated clock by
+    // roughly what it costs on the nano, so the burner logic can be run and
+    // timed without a board.
+    #include "sim28c256.h"
+
+    const uint32_t Cycles_SpiStart  = 2;    // out SPDR
+    const uint32_t Cycles_SpiShift  = 128;  // 8 bits at 1 MHz
+    const uint32_t Cycles_SpiWait   = 6;    // SPIF loop, once it's set
+    const uint32_t Cycles_SpiByte   = Cycles_SpiStart + Cycles_SpiShift + Cycles_SpiWait;
+    const uint32_t Cycles_Strobe    = 4;    // RCLK up and down
+    const uint32_t Cycles_AddrCheck = 6;    // compare with s_prevAddrHigh
+    const uint32_t Cycles_DataRead  = 5;    // two port reads, masked and or-ed
+    const uint32_t Cycles_DataWrite = 10;   // two masked port writes
+    const uint32_t Cycles_PinWrite  = 2;    // sbi or cbi
+
+    // As on the nano, chip select is on A15 and changes along with the rest
+    // of the address.
+    //
+    // The shift of the low byte overlaps whatever happens between
+    // beginAddress and endAddress, as on the nano. endAddress only waits for
+    // what's left of it.
+    static bool s_chipSelected = false;
+    static uint8_t s_prevAddrHigh = 0xff;
+    static uint16_t s_pendingAddress;
+    static uint64_t s_shiftDone;
+
+    static void startShift() {
+        sim_advance(Cycles_SpiStart);
+        s_shiftDone = sim_cycles() + Cycles_SpiShift;
+    }
+
+    static void waitShift() {
+        uint64_t now = sim_cycles();
+        if (now < s_shiftDone) {
+            sim_advance(s_shiftDone - now);
+        }
+        sim_advance(Cycles_SpiWait + Cycles_Strobe);
+    }
+
+    static void beginAddress(uint16_t address) {
+        uint8_t addrHigh = (address >> 8) | (s_chipSelected ? 0x80 : 0x00);
+
+        sim_advance(Cycles_AddrCheck);
+        if (s_prevAddrHigh != addrHigh) {
+            sim_advance(Cycles_SpiByte);
+            s_prevAddrHigh = addrHigh;
+        }
+        startShift();
+        s_pendingAddress = address;
+    }
+
+    static void endAddress() {
+        waitShift();
+        sim_setAddress(s_pendingAddress);
+        sim_setChipEnable(s_chipSelected);
+    }
+
+    static void setAddress(uint16_t address) {
+        beginAddress(address);
+        endAddress();
+    }
+
+    static uint8_t readData() {
+        sim_advance(Cycles_DataRead);
+        return sim_readData();
+    }
+
+    static void writeData(uint8_t data) {
+        sim_advance(Cycles_DataWrite);
+        sim_writeData(data);
+    }
+
+    static void setDataReadMode() {
+        sim_advance(Cycles_DataWrite);
+    }
+
+    static void setDataWriteMode() {
+        sim_advance(Cycles_DataWrite);
+    }
+
+    static void setChipSelect(bool chipSelectOn, uint16_t address) {
+        s_chipSelected = chipSelectOn;
+        setAddress(address);
+    }
+
+    // Bus access for the full page kernels. See PageBus in the nano section.
+    const uint32_t Cycles_DataWriteCached = 6;  // two or-and-out
+    struct PageBus {
+        void beginAddressLow(uint8_t addrLow) const {
+            startShift();
+            s_pendingAddress = ((s_prevAddrHigh & 0x7f) << 8) | addrLow;
+        }
+
+        void endAddressLow() const {
+            waitShift();
+            sim_setAddress(s_pendingAddress);
+        }
+
+        void writeData(uint8_t data) const {
+            sim_advance(Cycles_DataWriteCached);
+            sim_writeData(data);
+        }
+
+        uint8_t readData() const {
+            return ::readData();
+        }
+    };
+
+    static void initPins() {
+        s_chipSelected = false;
+        s_prevAddrHigh = 0xff;
+    }
+
+    static void outputEnableOn()    { sim_advance(Cycles_PinWrite); sim_setOutputEnable(true); }
+    static void outputEnableOff()   { sim_advance(Cycles_PinWrite); sim_setOutputEnable(false); }
+
+    static void writeEnableOn()     { sim_advance(Cycles_PinWrite); sim_setWriteEnable(true); }
+    static void writeEnableOff()    { sim_advance(Cycles_PinWrite); sim_setWriteEnable(false); }
+
 #else
     #error "Building for UNKNOWN"
 #endif
 
-const uint8_t Page_Bits = 6;
-const uint8_t Page_Size = 1 << Page_Bits;
-
 static ebError waitForWriteCompletion(uint8_t expectedData, uint16_t address);
+static uint16_t clampUs(uint32_t us);
 
-// All three control lines are active low.
-static void outputEnableOn()    { CLEAR_PORT_BIT(CONTROL, Control_OE); }
-static void outputEnableOff()   { SET_PORT_BIT(CONTROL,   Control_OE); }
+#if !defined(NATIVE)
+    // All three control lines are active low.
+    static void outputEnableOn()    { CLEAR_PORT_BIT(CONTROL, Control_OE); }
+    static void outputEnableOff()   { SET_PORT_BIT(CONTROL,   Control_OE); }
 
-static void writeEnableOn()     { CLEAR_PORT_BIT(CONTROL, Control_WE); }
-static void writeEnableOff()    { SET_PORT_BIT(CONTROL,   Control_WE); }
+    static void writeEnableOn()     { CLEAR_PORT_BIT(CONTROL, Control_WE); }
+    static void writeEnableOff()    { SET_PORT_BIT(CONTROL,   Control_WE); }
+#endif
 
 void eb_init() {
     initPins();
 }
 
+void eb_setPollHook(ebPollHook* hook) {
+    s_pollHook = hook;
+}
+
+void eb_setPollMode(ebPollMode mode) {
+    s_pollMode = mode;
+}
+
+void eb_getWriteCycleStats(ebWriteCycleStats* stats) {
+    *stats = s_writeCycleStats;
+}
+
+void eb_getPageTiming(ebPageTiming* timing) {
+    *timing = s_pageTiming;
+}
+
+void eb_getCounters(ebCounters* counters) {
+    *counters = s_counters;
+}
+
+void eb_resetCounters() {
+    memset(&s_counters, 0, sizeof(s_counters));
+}
+
 void eb_beginSession() {
     captureBus();
     s_busCaptured = true;
+
+    if (s_writeCycleStats.count > 0) {
+        s_writeCycleStats.lastAvgUs = s_writeCycleStats.totalUs / s_writeCycleStats.count;
+    }
+    s_writeCycleStats.count = 0;
+    s_writeCycleStats.minUs = 0xffff;
+    s_writeCycleStats.maxUs = 0;
+    s_writeCycleStats.totalUs = 0;
 }
 
 void eb_endSession(bool doReset) {
@@ -383,8 +632,14 @@ ebError eb_chipErase() {
         return ebError_OutOfSession;
     }
 
-    uint16_t address[] = { 0x5555, 0x2aaa, 0x5555, 0x5555, 0x2aaa, 0x5555 };
-    uint8_t  data[]    = {   0xaa,   0x55,   0x80,   0xaa,   0x55,   0x10 };
+    if (!c_chip.chipErase) {
+        return ebError_NotSupported;
+    }
+
+    const uint16_t u1 = c_chip.unlock1;
+    const uint16_t u2 = c_chip.unlock2;
+    uint16_t address[] = {   u1,   u2,   u1,   u1,   u2,   u1 };
+    uint8_t  data[]    = { 0xaa, 0x55, 0x80, 0xaa, 0x55, 0x10 };
 
     setChipSelect(true, address[0]);
     setDataWriteMode();
@@ -396,7 +651,7 @@ ebError eb_chipErase() {
 
         writeEnableOn();    // falling edge latches address
 
-        NOP; NOP;           // tWP = 100
+        nops<c_chip.writePulseNops>(); // tWP
 
         writeEnableOff();   // rising edge latches data
 
@@ -404,12 +659,117 @@ ebError eb_chipErase() {
     }
 
     setDataReadMode();
-    delay(25); // Erase cycle is <= 20ms
+    delay(c_chip.eraseMs + 5); // tEC, and a bit
     setChipSelect(false, 0);
 
     return ebError_OK;
 }
 
+// Full, aligned pages have their own kernels. The high address byte is set
+// once for the whole page by setChipSelect, and the loop over the low byte is
+// unrolled Kernel_Unroll times at compile time. Fully unrolling all 64 bytes
+// costs a lot of flash for little extra gain.
+//
+// Each byte starts the next address shifting out before doing its own data
+// I/O, see beginAddress. The address of the first byte is already latched,
+// and the last byte doesn't start another, so that the last address written
+// is still set for waitForWriteCompletion.
+//
+// Partial pages go through the generic loops in eb_writePage and
+// eb_verifyPage.
+
+const uint8_t Kernel_Unroll = 8;
+static_assert(c_pageSize % Kernel_Unroll == 0, "page size must be a multiple of the unroll");
+
+static ALWAYS_INLINE void loadData(const PageBus& bus, uint8_t data) {
+    bus.writeData(data);
+
+    writeEnableOn();    // falling edge latches address
+
+    nops<c_chip.writePulseNops>(); // tWP
+
+    writeEnableOff();   // rising edge latches data
+
+    NOP;                // tWPH = 50
+}
+
+static ALWAYS_INLINE uint8_t compareData(const PageBus& bus, uint8_t data) {
+    nops<c_chip.accessNops>(); // tACC, tCE, tOE
+
+    uint8_t diff = bus.readData() ^ data;
+
+    NOP;                // tDF = 50ns
+
+    return diff;
+}
+
+// Loads data at the latched address, then latches nextLow.
+static ALWAYS_INLINE void loadByte(const PageBus& bus, uint8_t nextLow, uint8_t data) {
+    bus.beginAddressLow(nextLow);
+    loadData(bus, data);
+    bus.endAddressLow();
+}
+
+// Compares data with the latched address, then latches nextLow.
+static ALWAYS_INLINE uint8_t compareByte(const PageBus& bus, uint8_t nextLow, uint8_t data) {
+    bus.beginAddressLow(nextLow);
+    uint8_t diff = compareData(bus, data);
+    bus.endAddressLow();
+    return diff;
+}
+
+template <uint8_t Count>
+struct Unrolled {
+    static ALWAYS_INLINE void load(const PageBus& bus, uint8_t addrLow, const uint8_t* data) {
+        loadByte(bus, addrLow + 1, data[0]);
+        Unrolled<Count - 1>::load(bus, addrLow + 1, data + 1);
+    }
+
+    static ALWAYS_INLINE uint8_t compare(const PageBus& bus, uint8_t addrLow, const uint8_t* data) {
+        uint8_t diff = compareByte(bus, addrLow + 1, data[0]);
+        return diff | Unrolled<Count - 1>::compare(bus, addrLow + 1, data + 1);
+    }
+};
+
+template <>
+struct Unrolled<0> {
+    static ALWAYS_INLINE void load(const PageBus&, uint8_t, const uint8_t*) { }
+    static ALWAYS_INLINE uint8_t compare(const PageBus&, uint8_t, const uint8_t*) { return 0; }
+};
+
+static bool isFullPage(uint16_t address, uint8_t size) {
+    return size == c_pageSize && (address & (c_pageSize - 1)) == 0;
+}
+
+// On entry, chip select is on with the page address set, and the data port
+// is in write mode. On exit, the address of the last byte is set.
+static void loadFullPage(uint16_t address, const uint8_t* data) {
+    PageBus bus;
+    uint8_t addrLow = address & 0xff;
+    for (uint8_t i = 0; i < c_pageSize / Kernel_Unroll - 1; i++) {
+        Unrolled<Kernel_Unroll>::load(bus, addrLow, data);
+        addrLow += Kernel_Unroll;
+        data += Kernel_Unroll;
+    }
+    Unrolled<Kernel_Unroll - 1>::load(bus, addrLow, data);
+    loadData(bus, data[Kernel_Unroll - 1]);
+}
+
+// On entry, chip select and output enable are on with the page address set.
+static bool compareFullPage(uint16_t address, const uint8_t* data) {
+    PageBus bus;
+    uint8_t addrLow = address & 0xff;
+    for (uint8_t i = 0; i < c_pageSize / Kernel_Unroll - 1; i++) {
+        if (Unrolled<Kernel_Unroll>::compare(bus, addrLow, data) != 0) {
+            return false;
+        }
+        addrLow += Kernel_Unroll;
+        data += Kernel_Unroll;
+    }
+    uint8_t diff = Unrolled<Kernel_Unroll - 1>::compare(bus, addrLow, data);
+    return (diff | compareData(bus, data[Kernel_Unroll - 1])) == 0;
+}
+
 ebError eb_writePage(uint16_t address, const uint8_t* data, uint8_t size) {
     if (!s_busCaptured) {
         return ebError_OutOfSession;
@@ -419,31 +779,51 @@ ebError eb_writePage(uint16_t address, const uint8_t* data, uint8_t size) {
         return ebError_OK;
     }
 
-    uint16_t startPage = address >> Page_Bits;
-    uint16_t endPage   = (address + size - 1) >> Page_Bits;
+    uint16_t startPage = address >> c_pageBits;
+    uint16_t endPage   = (address + size - 1) >> c_pageBits;
 
     if (startPage != endPage) {
         return ebError_PageBoundaryCrossed;
     }
 
+    uint32_t loadStart = micros();
     setChipSelect(true, address);
     setDataWriteMode();
-    for (uint8_t offset = 0; offset < size; offset++) {
+    if (isFullPage(address, size)) {
+        loadFullPage(address, data);
+    }
+    else {
+        // As in the kernels, the next address shifts out while this byte
+        // loads, and the last one stays set.
+        for (uint8_t offset = 0; offset < size; offset++) {
+            bool next = offset + 1 < size;
+            if (next) {
+                beginAddress(address + offset + 1);
+            }
 
-        setAddress(address + offset);
-        writeData(data[offset]);
+            writeData(data[offset]);
 
-        writeEnableOn();    // falling edge latches address
+            writeEnableOn();    // falling edge latches address
 
-        NOP; NOP;           // tWP = 100
+            nops<c_chip.writePulseNops>(); // tWP
 
-        writeEnableOff();   // rising edge latches data
+            writeEnableOff();   // rising edge latches data
 
-        NOP;                // tWPH = 50
+            NOP;                // tWPH = 50
+
+            if (next) {
+                endAddress();
+            }
+        }
     }
     setDataReadMode();
 
-    return waitForWriteCompletion(data[size - 1], address + size - 1);
+    uint32_t waitStart = micros();
+    s_pageTiming.loadUs = clampUs(waitStart - loadStart);
+
+    ebError ret = waitForWriteCompletion(data[size - 1], address + size - 1);
+    s_pageTiming.waitUs = clampUs(micros() - waitStart);
+    return ret;
 }
 
 bool eb_verifyPage(uint16_t address, const uint8_t* data, uint8_t size, bool verbose) {
@@ -454,20 +834,38 @@ bool eb_verifyPage(uint16_t address, const uint8_t* data, uint8_t size, bool ver
     setChipSelect(true, address);
     outputEnableOn();
 
+    // The kernel can't say where the mismatch is, so verbose callers get the
+    // generic loop.
+    if (!verbose && isFullPage(address, size)) {
+        bool ok = compareFullPage(address, data);
+        outputEnableOff();
+        setChipSelect(false, 0);
+        return ok;
+    }
+
     bool ok = true;
 
     for (uint8_t offset = 0; offset < size; offset++) {
-        setAddress(address + offset);
+        bool next = offset + 1 < size;
+        if (next) {
+            beginAddress(address + offset + 1);
+        }
 
-        NOP; NOP; NOP; // tACC = 150ns, tCE = 150ns, tOE = 70
+        nops<c_chip.accessNops>(); // tACC, tCE, tOE
 
         uint8_t byteRead = readData();
 
+        NOP; // tDF = 50ns
+
+        if (next) {
+            endAddress();
+        }
+
         if (byteRead != data[offset]) {
             ok = false;
             if (verbose) {
                 Serial.print("MSG:Verify failed at page ");
-                Serial.print(address / 64);
+                Serial.print(address / c_pageSize);
                 Serial.print(" offset ");
                 Serial.print(offset);
                 Serial.print("\nMSG:Expecting 0x");
@@ -478,14 +876,80 @@ bool eb_verifyPage(uint16_t address, const uint8_t* data, uint8_t size, bool ver
             }
             break;
         }
+    }
+
+    outputEnableOff();
+    setChipSelect(false, 0);
+
+    return ok;
+}
+
+ebError eb_readPage(uint16_t address, uint8_t* data, uint8_t size) {
+    if (!s_busCaptured) {
+        return ebError_OutOfSession;
+    }
+
+    setChipSelect(true, address);
+    outputEnableOn();
+
+    for (uint8_t offset = 0; offset < size; offset++) {
+        bool next = offset + 1 < size;
+        if (next) {
+            beginAddress(address + offset + 1);
+        }
+
+        nops<c_chip.accessNops>(); // tACC, tCE, tOE
+
+        data[offset] = readData();
 
         NOP; // tDF = 50ns
+
+        if (next) {
+            endAddress();
+        }
     }
 
     outputEnableOff();
     setChipSelect(false, 0);
 
-    return ok;
+    return ebError_OK;
+}
+
+// Reads size bytes starting at address, handing each one to sink. Chip select
+// and output enable stay on for the whole range, and beginAddress only shifts
+// out the low address byte until the high byte changes. The next address
+// shifts out while sink deals with this byte.
+ebError eb_readRange(uint16_t address, uint16_t size, ebReadSink* sink) {
+    if (!s_busCaptured) {
+        return ebError_OutOfSession;
+    }
+
+    setChipSelect(true, address);
+    outputEnableOn();
+
+    for (uint16_t offset = 0; offset < size; offset++) {
+        bool next = offset + 1 < size;
+        if (next) {
+            beginAddress(address + offset + 1);
+        }
+
+        nops<c_chip.accessNops>(); // tACC, tCE, tOE
+
+        uint8_t data = readData();
+
+        NOP; // tDF = 50ns
+
+        sink(data);
+
+        if (next) {
+            endAddress();
+        }
+    }
+
+    outputEnableOff();
+    setChipSelect(false, 0);
+
+    return ebError_OK;
 }
 
 const char* eb_errorMessage(ebError error) {
@@ -506,60 +970,134 @@ const char* eb_errorMessage(ebError error) {
     case ebError_OutOfSession:
         return "out of session";
 
+    case ebError_NotSupported:
+        return "not supported by this chip";
+
     default:
         return "unknown error code";
     }
 }
 
-static ebError waitForWriteCompletion(uint8_t expectedData, uint16_t address) {
-    const long maxRetries = 100000;
+const uint8_t DQ6 = BIT(6);
+const uint8_t DQ7 = BIT(7);
+const uint32_t WriteCompletionTimeoutUs = 2 * (uint32_t) c_chip.writeCycleUs;
+const uint16_t LearnedDelayMinSamples = 4;
 
-    // On entry, chip select is on, output and write enable are off.
-    // DATA port is set to input.
+// One read cycle, toggling only output enable.
+static uint8_t pollData() {
     outputEnableOn();
-    NOP; NOP;
+    NOP; NOP;       // tOE = 70ns
+    uint8_t data = readData();
+    outputEnableOff();
+    NOP;            // tDF = 50ns
+    return data;
+}
 
-    uint8_t prevData = readData();
+static uint16_t clampUs(uint32_t us) {
+    return us > 0xffff ? 0xffff : us;
+}
 
-    setChipSelect(false, address);
-    outputEnableOff();
-    NOP; NOP;
+static void recordWriteCycle(uint32_t elapsedUs) {
+    uint16_t us = clampUs(elapsedUs);
+    ebWriteCycleStats& stats = s_writeCycleStats;
+    stats.count++;
+    stats.totalUs += us;
+    if (us < stats.minUs) {
+        stats.minUs = us;
+    }
+    if (us > stats.maxUs) {
+        stats.maxUs = us;
+    }
+}
 
-    ebError ret = ebError_WriteCompletionTimeout;
+static ebError waitForWriteCompletion(uint8_t expectedData, uint16_t address) {
+    // On entry, chip select is on and the address of the last byte written is
+    // still set, output and write enable are off. DATA port is set to input.
+    // We leave the address and chip select alone until we're done.
+    uint32_t start = micros();
 
-    for (long attempt = 0; attempt < maxRetries; attempt++) {
-        setChipSelect(true, address);
-        outputEnableOn();
-        NOP; NOP;
-        uint8_t nextData = readData();
-        outputEnableOff();
-        setChipSelect(false, address);
-        NOP; NOP;
-
-        if (prevData == nextData) {
-            if (nextData != expectedData) {
-                Serial.print("MSG:Write poll data mismatch at page ");
-                Serial.print(address / 64);
-                Serial.print(" on attempt ");
-                Serial.print(attempt);
-                Serial.print("\nMSG:Expected 0x");
-                Serial.print(expectedData, HEX);
-                Serial.print(", got 0x");
-                Serial.print(nextData, HEX);
-                Serial.print("\n");
+    // The first read ends the page load, so the write cycle starts now rather
+    // than after tBLC.
+    ebError ret = ebError_WriteCompletionTimeout;
+    uint8_t prevData = pollData();
+    uint8_t nextData = prevData;
+
+    // Once we've seen a few write cycles, the delay mode leaves the bus alone
+    // for 7/8ths of the shortest of them, and only polls for the rest. That
+    // finishes as soon as polling would, with a fraction of the read cycles
+    // on the chip while it's writing. Waiting out the longest cycle instead
+    // would lose the difference between them on every page.
+    bool delayed = false;
+    if (s_pollMode == ebPollMode_Delay
+            && s_writeCycleStats.count >= LearnedDelayMinSamples) {
+        uint32_t delayUs = s_writeCycleStats.minUs - s_writeCycleStats.minUs / 8;
+        while (micros() - start < delayUs) {
+            if (s_pollHook != NULL) {
+                s_pollHook();
             }
+        }
+        delayed = true;
+        prevData = pollData();
+    }
+
+    uint32_t elapsed = 0;
+    long attempt;
+
+    for (attempt = 0; elapsed < WriteCompletionTimeoutUs; attempt++) {
+        nextData = pollData();
+        elapsed = micros() - start;
+
+        bool done = (s_pollMode == ebPollMode_Data)
+                  ? ((nextData ^ expectedData) & DQ7) == 0
+                  : ((nextData ^ prevData) & DQ6) == 0;
+
+        if (done) {
+            // DQ7 can come good before the other bits do, so read it again.
+            nextData = pollData();
             ret = (nextData == expectedData)
                 ? ebError_OK : ebError_WriteCompletionDataMismatch;
             break;
         }
 
         prevData = nextData;
+
+        if (s_pollHook != NULL) {
+            s_pollHook();
+        }
+    }
+
+    s_counters.polls += attempt;
+    if (attempt > s_counters.maxPolls) {
+        s_counters.maxPolls = attempt > 0xffff ? 0xffff : attempt;
+    }
+    if (ret == ebError_WriteCompletionTimeout) {
+        s_counters.timeouts++;
+    }
+
+    if (ret == ebError_WriteCompletionDataMismatch) {
+        s_counters.mismatches++;
+        Serial.print("MSG:Write poll data mismatch at page ");
+        Serial.print(address / c_pageSize);
+        Serial.print(" on attempt ");
+        Serial.print(attempt);
+        Serial.print("\nMSG:Expected 0x");
+        Serial.print(expectedData, HEX);
+        Serial.print(", got 0x");
+        Serial.print(nextData, HEX);
+        Serial.print("\n");
+    }
+
+    // If the chip was already done when the learned delay ran out, all we've
+    // measured is the delay, so don't let it feed back into itself.
+    if (ret == ebError_OK && !(delayed && attempt == 0)) {
+        recordWriteCycle(elapsed);
     }
 
     setChipSelect(false, 0);
     return ret;
 }
 
+#if !defined(NATIVE)
 static void waitForKey(HardwareSerial& serial) {
     while (!serial.available()) { }
     while (serial.available()) {
@@ -567,6 +1105,7 @@ static void waitForKey(HardwareSerial& serial) {
         delay(1);
     }
 }
+#endif
 
 #define SKIP_PIN(number, func) \
     serial.println("Pin " #number " is " func); \
@@ -659,4 +1198,11 @@ static void waitForKey(HardwareSerial& serial) {
         SET_PIN(27, CONTROL, 0);
         SKIP_PIN(28,  "+5V");
     }
+
+#elif defined(NATIVE)
+
+    void eb_pinTest(HardwareSerial& serial) {
+        serial.println("No pins to test on the native build");
+    }
+
 #endif
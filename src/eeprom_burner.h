@@ -2,6 +2,7 @@
 #define INCLUDE_EEPROM_BURNER_H
 
 #include <Arduino.h>
+#include "chips.h"
 
 enum ebError {
     ebError_OK = 0,
@@ -9,15 +10,66 @@ enum ebError {
     ebError_WriteCompletionDataMismatch,
     ebError_WriteCompletionTimeout,
     ebError_OutOfSession,
+    ebError_NotSupported,
 };
 
+// How eb_writePage detects the end of the write cycle. In every mode, only
+// output enable is toggled while polling; the address stays put.
+enum ebPollMode {
+    ebPollMode_Toggle = 0,      // wait for DQ6 to stop toggling
+    ebPollMode_Data,            // wait for DQ7 to match the last byte written
+    ebPollMode_Delay,           // sit out most of the shortest write cycle
+                                // seen so far, then poll DQ6 for the rest
+};
+
+// Observed write cycle times, from the end of the page load until completion
+// was detected. Reset by eb_beginSession, except lastAvgUs.
+struct ebWriteCycleStats {
+    uint16_t count;
+    uint16_t minUs;
+    uint16_t maxUs;
+    uint32_t totalUs;
+    uint16_t lastAvgUs;         // average over the last session that wrote
+                                // anything, or 0 if none has since eb_init
+};
+
+// Running totals of how write completion went, since eb_init or the last
+// eb_resetCounters. Sessions don't reset them.
+struct ebCounters {
+    uint32_t polls;             // completion polls, over all writes
+    uint16_t maxPolls;          // most polls for any one write
+    uint16_t timeouts;          // writes that never completed
+    uint16_t mismatches;        // writes that completed with the wrong data
+};
+
+// How long each phase of the last eb_writePage took, in microseconds.
+struct ebPageTiming {
+    uint16_t loadUs;            // loading the data into the chip
+    uint16_t waitUs;            // waiting for the write cycle to complete
+};
+
+// Called repeatedly while waiting for a page write to complete, so the caller
+// can get on with something else, like receiving the next page.
+typedef void (ebPollHook)(void);
+
+// Receives each byte read by eb_readRange, in address order.
+typedef void (ebReadSink)(uint8_t data);
+
 extern void eb_init();
+extern void eb_setPollHook(ebPollHook* hook);
+extern void eb_setPollMode(ebPollMode mode);
+extern void eb_getWriteCycleStats(ebWriteCycleStats* stats);
+extern void eb_getPageTiming(ebPageTiming* timing);
+extern void eb_getCounters(ebCounters* counters);
+extern void eb_resetCounters();
 extern void eb_beginSession();
 extern void eb_endSession(bool doReset);
 
 extern ebError eb_chipErase();
 extern ebError eb_writePage(uint16_t address, const uint8_t* data, uint8_t size);
 extern bool eb_verifyPage(uint16_t address, const uint8_t* data, uint8_t size, bool verbose = false);
+extern ebError eb_readPage(uint16_t address, uint8_t* data, uint8_t size);
+extern ebError eb_readRange(uint16_t address, uint16_t size, ebReadSink* sink);
 
 extern const char* eb_errorMessage(ebError error);
 
@@ -0,0 +1,61 @@
+#include "frame.h"
+#include "crc.h"
+#include <string.h>
+
+bool parseFrame(const uint8_t* buffer, uint16_t size, Frame* frame) {
+
+    if (size < c_frameHeaderSize + c_frameTrailerSize || buffer[0] != c_frameStart) {
+        return false;
+    }
+
+    uint8_t length = buffer[1];
+    if (length < 4 || length > c_frameMaxLength) {
+        return false;
+    }
+
+    if (size != c_frameHeaderSize + length + c_frameTrailerSize) {
+        return false;
+    }
+
+    const uint8_t* body = buffer + c_frameHeaderSize;
+    uint16_t expectedCrc = (body[length] << 8) | body[length + 1];
+    if (crc16(body, length) != expectedCrc) {
+        return false;
+    }
+
+    frame->op       = body[0];
+    frame->seq      = body[1];
+    frame->address  = (body[2] << 8) | body[3];
+    frame->dataSize = length - 4;
+    frame->data     = body + 4;
+
+    return true;
+}
+
+int16_t unpackBits(const uint8_t* data, uint8_t dataSize, uint8_t* buffer, uint8_t bufferSize) {
+    const uint8_t* end = data + dataSize;
+    uint8_t size = 0;
+
+    while (data < end) {
+        uint8_t header = *data++;
+        if (header < 128) {
+            uint8_t count = header + 1;
+            if (count > end - data || count > bufferSize - size) {
+                return -1;
+            }
+            memcpy(buffer + size, data, count);
+            data += count;
+            size += count;
+        }
+        else if (header > 128) {
+            uint8_t count = 257 - header;
+            if (data == end || count > bufferSize - size) {
+                return -1;
+            }
+            memset(buffer + size, *data++, count);
+            size += count;
+        }
+    }
+
+    return size;
+}
@@ -0,0 +1,50 @@
+#ifndef INCLUDE_FRAME_H
+#define INCLUDE_FRAME_H
+
+#include <stdint.h>
+#include "chips.h"
+
+// Binary page frame. Once the host has switched to binary mode, pages can be
+// sent as raw bytes instead of as hex SREC text:
+//
+//   STX len op seq addrHigh addrLow data... crcHigh crcLow
+//
+// len counts the op, seq, address and data bytes. The CRC16 is computed over
+// those same len bytes. A full 64 byte page is 72 bytes on the wire, against
+// 140 for the equivalent "W" SREC line. A frame holds up to a page.
+//
+// seq increments by one (mod 256) with each frame, and is echoed back in the
+// ACK, so the host can have several frames in flight.
+struct Frame {
+    char op;
+    uint8_t seq;
+    uint16_t address;
+    uint8_t dataSize;
+    const uint8_t* data;
+};
+
+const uint8_t c_frameStart = 0x02; // STX
+const uint8_t c_frameHeaderSize = 2; // STX + len
+const uint8_t c_frameTrailerSize = 2; // CRC16
+const uint8_t c_frameMaxData = c_pageSize;
+const uint8_t c_frameMaxLength = 1 + 1 + 2 + c_frameMaxData; // op + seq + addr + data
+const uint8_t c_frameBufferSize = c_frameHeaderSize + c_frameMaxLength + c_frameTrailerSize;
+
+// If buffer holds a valid frame, fills in frame and returns true. The data
+// pointer in frame points into buffer.
+extern bool parseFrame(const uint8_t* buffer, uint16_t size, Frame* frame);
+
+// A Z frame carries a compressed page. The first data byte is the real op, W
+// or V, and the rest is PackBits:
+//
+//   0..127     the next n+1 bytes are literal
+//   129..255   the next byte is repeated 257-n times
+//   128        no-op
+//
+// A page of padding compresses to 2 bytes, so the whole frame is 11.
+
+// Expands PackBits data into buffer, which has room for bufferSize bytes.
+// Returns the expanded size, or -1 if the data is malformed or won't fit.
+extern int16_t unpackBits(const uint8_t* data, uint8_t dataSize, uint8_t* buffer, uint8_t bufferSize);
+
+#endif // INCLUDE_FRAME_H
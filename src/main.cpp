@@ -1,9 +1,79 @@
 #include <Arduino.h>
+#include "crc.h"
 #include "eeprom_burner.h"
+#include "frame.h"
+#include "receiver.h"
 #include "srec.h"
 
-static char s_buffer[c_srecBufferSize + 1];
-static uint16_t readBytesUntil(char terminator, char *buffer, size_t length, uint32_t timeout);
+// Holds a command line, or the frame being processed. It needs to be big
+// enough for either. S-records don't pass through here, as the receiver
+// decodes them as they arrive.
+static char s_buffer[c_frameBufferSize];
+
+// Set by the BINARY command. When set, page frames are accepted alongside the
+// ASCII command lines.
+static bool s_binaryMode = false;
+static void setBinaryMode(bool binaryMode);
+static void handleFrame();
+static void handleRecord();
+
+// Frames are taken from the receiver into s_buffer to be processed. While a
+// page is being written, the receiver assembles the next frame, and any after
+// that wait in the serial receive ring. So the host can keep one frame in
+// flight for each of those, plus the one being written.
+static uint8_t s_nextSeq = 0;
+const uint8_t c_maxWindow = 2 + (SERIAL_RX_BUFFER_SIZE - 1) / c_frameBufferSize;
+
+static uint16_t s_reportedRingFulls = 0;
+
+// Running totals, so we can spot chips and links going bad over many burns.
+// Only STATS RESET clears them. The write completion ones are kept by the
+// burner, see ebCounters.
+struct Counters {
+    uint32_t pagesWritten;      // pages that needed writing
+    uint32_t pagesVerified;     // pages that already matched
+    uint16_t writeRetries;
+    uint16_t parseErrors;       // bad records and frames
+    uint16_t rxFull;            // times the serial receive ring filled up
+    uint16_t lineOverruns;      // lines too long for s_buffer
+    uint16_t rxTimeouts;
+    uint16_t linkErrors;        // input rejected as garbage, of any kind
+};
+static Counters s_counters;
+static void sendStats(const char* args);
+
+// How long each phase of the current page op took. With TIMING ON, these are
+// appended to the page ACKs, as
+//
+//   ACK:W:<address>:<size>[:seq] T=<receive>,<parse>,<verify>,<load>,<wait>
+//
+// all in microseconds. Phases that didn't happen are zero.
+struct PhaseTimes {
+    uint16_t receiveUs;
+    uint16_t parseUs;
+    uint16_t verifyUs;
+    uint16_t loadUs;
+    uint16_t waitUs;
+};
+static bool s_timing = false;
+static PhaseTimes s_phases;
+static void startPhases();
+static uint16_t clampUs(uint32_t us);
+
+// The host can switch to a faster rate with BAUD. We drop back to
+// c_defaultBaud at END, or if the host doesn't SYNC at the new rate within
+// c_baudSyncMillis, or if the link goes quiet for c_baudIdleMillis, or if
+// anything garbled arrives. So a host that has lost track of us can always
+// start again at the default rate.
+const uint32_t c_defaultBaud = 115200;
+const uint32_t c_baudSyncMillis = 1000;
+const uint32_t c_baudIdleMillis = 5000;
+static uint32_t s_baud = c_defaultBaud;
+static bool s_baudSynced = true;
+static uint32_t s_lastCommandMillis;
+static void setBaud(const char* args);
+static void switchBaud(uint32_t baud);
+static void linkError();
 
 static void stateIdle();
 static void stateActive();
@@ -14,21 +84,55 @@ static State* s_state;
 enum PageOp {
     WritePage  = 'W',
     VerifyPage = 'V',
+    StagePage  = 'S',
+    PackedPage = 'Z',   // a W, V or F frame, with PackBits data
+    ForcePage  = 'F',   // a W without the verify first, acked as W
 };
 
+// Page ops from SREC lines have no sequence number.
+const int16_t c_noSeq = -1;
+
+static void sendPageMap();
+static void sendRange(const char* args);
+static void sendByte(uint8_t data);
+static void sendChecksum(const char* args);
+static void checksumByte(uint8_t data);
+static void setPollMode(const char* mode);
+static void sendWriteCycleStats();
+static void sendInfo();
+static void setTiming(const char* mode);
+static void fillRange(const char* args);
+
+static void pageOp(PageOp op, uint16_t address, const uint8_t* data, uint8_t size, int16_t seq);
+static PageOp burnPage(uint16_t address, const uint8_t* data, uint8_t size, bool verifyFirst = true);
+
+// Set by STAGE ON. Writes are then merged into s_stage, which starts out as
+// a copy of the page in the ROM. The page is only burned when a write for
+// some other page arrives, or any other command does. That way a page made
+// of several small records costs a single write cycle.
+static bool s_staging = false;
+static uint8_t s_stage[c_pageSize];
+static int16_t s_stagePage = -1;
+static void stageOp(uint16_t address, const uint8_t* data, uint8_t size, int16_t seq);
+static bool commitStage();
+static void setStaging(const char* mode);
+
 static void ack(const char* message);
-static void ack(const SRec1* srec, PageOp op);
+static void ack(PageOp op, uint16_t address, uint8_t size, int16_t seq);
 
 static void nak(const char* message);
 static void nak(const char* message1, const char* message2);
 
 static void msg(const char* message);
+static void printHex16(uint16_t value);
 
 void setup() {
-    Serial.begin(115200);
+    Serial.begin(c_defaultBaud);
     s_state = stateIdle;
 
     eb_init();
+    eb_setPollHook(rx_pollFrame);
+    rx_init(s_buffer, sizeof(s_buffer));
 
     // This bugged me for ages. Connecting to the serial port on the arduino
     // causes it to reset. The sending script will send whatever, but the
@@ -45,42 +149,165 @@ void setup() {
 }
 
 void loop() {
-    uint16_t bytesRead = readBytesUntil('\n', s_buffer, sizeof(s_buffer), 1000);
+    if (rx_ringFulls() != s_reportedRingFulls) {
+        s_counters.rxFull += rx_ringFulls() - s_reportedRingFulls;
+        s_reportedRingFulls = rx_ringFulls();
+    }
 
-    if (bytesRead <= 1) {
-        // Ignore this case. No input, or just a newline.
-        return;
+    if (s_baud != c_defaultBaud) {
+        uint32_t limit = s_baudSynced ? c_baudIdleMillis : c_baudSyncMillis;
+        if (millis() - s_lastCommandMillis > limit) {
+            switchBaud(c_defaultBaud);
+        }
     }
 
-    if (s_buffer[bytesRead-1] != '\n') {
-        // If the final char of the buffer isn't a newline, we either timed out
-        // or we reached the end of the buffer.
-        if (bytesRead == sizeof(s_buffer)) {
+    RxStatus status = rx_poll();
+    switch (status) {
+        case rxStatus_None:
+            break;
+
+        case rxStatus_Line:
+            s_state();
+            break;
+
+        case rxStatus_Record:
+            handleRecord();
+            break;
+
+        case rxStatus_Frame:
+            handleFrame();
+            break;
+
+        case rxStatus_LineOverrun:
+            s_counters.lineOverruns++;
             nak("Buffer overrun");
-        }
-        else {
+            break;
+
+        case rxStatus_BadRecord:
+            s_counters.parseErrors++;
+            nak("Invalid srecord");
+            break;
+
+        case rxStatus_BadFrame:
+            s_counters.parseErrors++;
+            nak("Invalid frame");
+            break;
+
+        case rxStatus_Timeout:
+            s_counters.rxTimeouts++;
             nak("Serial read timeout");
+            break;
+    }
+
+    if (status == rxStatus_LineOverrun || status == rxStatus_BadRecord
+            || status == rxStatus_BadFrame || status == rxStatus_Timeout) {
+        linkError();
+    }
+
+    // Commands can take a while, so the idle time counts from the end of
+    // the last one.
+    if (status != rxStatus_None) {
+        s_lastCommandMillis = millis();
+    }
+}
+
+static void handleFrame() {
+    startPhases();
+    uint32_t parseStart = micros();
+
+    uint8_t* buffer = (uint8_t*) s_buffer;
+    uint16_t frameSize = rx_takeFrame(buffer);
+
+    Frame frame;
+    if (!parseFrame(buffer, frameSize, &frame)) {
+        s_counters.parseErrors++;
+        nak("Invalid frame");
+        return;
+    }
+
+    if (frame.op != WritePage && frame.op != VerifyPage && frame.op != ForcePage
+            && frame.op != PackedPage) {
+        nak("Unexpected frame op");
+        return;
+    }
+
+    if (frame.seq != s_nextSeq) {
+        // Once a frame has been lost, so is every one behind it. The host
+        // stops on the first NAK, and starts again from the lost frame with
+        // BINARY, which resets the sequence.
+        Serial.print("NAK:Frame out of sequence: expected ");
+        Serial.print(s_nextSeq, DEC);
+        Serial.print("\n");
+        return;
+    }
+    s_nextSeq++;
+
+    uint8_t page[c_pageSize];
+    if (frame.op == PackedPage) {
+        char op = frame.dataSize > 0 ? frame.data[0] : 0;
+        int16_t size = -1;
+        if (op == WritePage || op == VerifyPage || op == ForcePage) {
+            size = unpackBits(frame.data + 1, frame.dataSize - 1, page, sizeof(page));
+        }
+        if (size < 0) {
+            s_counters.parseErrors++;
+            nak("Invalid packed frame");
+            return;
         }
+        frame.op = op;
+        frame.data = page;
+        frame.dataSize = size;
+    }
+
+    s_phases.parseUs = clampUs(micros() - parseStart);
+    pageOp(PageOp(frame.op), frame.address, frame.data, frame.dataSize, frame.seq);
+}
+
+static void handleRecord() {
+    // Records are decoded as they arrive, so there's no parse phase.
+    startPhases();
+
+    char op;
+    const SRec1* s1 = rx_record(&op);
+
+    if (s_state != stateActive) {
+        nak("Unexpected in idle state");
+        linkError();
         return;
     }
 
-    // If we get here, we got a complete line.
-    s_buffer[bytesRead-1] = 0;
-    s_state();
+    pageOp(PageOp(op), s1->address, s1->data, s1->dataSize, c_noSeq);
+}
+
+static void setBinaryMode(bool binaryMode) {
+    s_binaryMode = binaryMode;
+    rx_setFramesEnabled(binaryMode);
 }
 
 static void stateIdle() {
     if (strcmp(s_buffer, "BEGIN") == 0) {
         eb_beginSession();
+        eb_setPollMode(ebPollMode_Toggle);
         s_state = stateActive;
+        setBinaryMode(false);
+        // END has burned any staged page already.
+        s_staging = false;
+        s_timing = false;
         ack("BEGIN");
         return;
     }
 
     nak("Unexpected in idle state", s_buffer);
+    linkError();
 }
 
 static void stateActive() {
+    // Anything other than a page op sees the staged page burned first, even
+    // BEGIN, since the host has been told it's staged.
+    if (!commitStage()) {
+        return;
+    }
+
     if (strcmp(s_buffer, "BEGIN") == 0) {
         // We might have this happen if the previous write failed midway
         // through, and we never got an END. Rather than reject it, just
@@ -88,14 +315,89 @@ static void stateActive() {
         //
         // Not sure if this still applies. It might not hurt to do it anyway.
         eb_beginSession();
+        eb_setPollMode(ebPollMode_Toggle);
+        setBinaryMode(false);
+        s_staging = false;
+        s_timing = false;
         ack("BEGIN");
         return;
     }
 
     if (strcmp(s_buffer, "END") == 0) {
+        s_staging = false;
         eb_endSession(true);
         s_state = stateIdle;
+        setBinaryMode(false);
         ack("END");
+        switchBaud(c_defaultBaud);
+        return;
+    }
+
+    if (strncmp(s_buffer, "BAUD ", 5) == 0) {
+        setBaud(s_buffer + 5);
+        return;
+    }
+
+    if (strcmp(s_buffer, "SYNC") == 0) {
+        // The host can hear us at the new rate, and we can hear it.
+        s_baudSynced = true;
+        ack("SYNC");
+        return;
+    }
+
+    if (strcmp(s_buffer, "BINARY") == 0) {
+        // Older hosts never send this, so they get the ASCII protocol only.
+        setBinaryMode(true);
+        s_nextSeq = 0;
+        ack("BINARY");
+        return;
+    }
+
+    if (strncmp(s_buffer, "WINDOW ", 7) == 0) {
+        // The host asks for the number of frames it would like to have in
+        // flight. See c_maxWindow for how many we can hold.
+        if (!s_binaryMode) {
+            nak("Window needs binary mode");
+            return;
+        }
+        int window = constrain(atoi(s_buffer + 7), 1, c_maxWindow);
+        Serial.print("ACK:WINDOW:");
+        Serial.print(window, DEC);
+        Serial.print("\n");
+        return;
+    }
+
+    if (strncmp(s_buffer, "STAGE ", 6) == 0) {
+        setStaging(s_buffer + 6);
+        return;
+    }
+
+    if (strcmp(s_buffer, "FLUSH") == 0) {
+        // The staged page has already been burned by now.
+        ack("FLUSH");
+        return;
+    }
+
+    if (strcmp(s_buffer, "PACKED") == 0) {
+        // Nothing to switch on. This lets the host know it can send Z frames
+        // and FILL.
+        if (!s_binaryMode) {
+            nak("Packed frames need binary mode");
+            return;
+        }
+        ack("PACKED");
+        return;
+    }
+
+    if (strcmp(s_buffer, "FORCE") == 0) {
+        // Nothing to switch on either. This lets the host know it can send
+        // F ops, for pages it knows have changed.
+        ack("FORCE");
+        return;
+    }
+
+    if (strncmp(s_buffer, "FILL ", 5) == 0) {
+        fillRange(s_buffer + 5);
         return;
     }
 
@@ -110,61 +412,552 @@ static void stateActive() {
         return;
     }
 
-    PageOp op;
-    if (s_buffer[0] == 'W') {
-        op = WritePage;
+    if (strcmp(s_buffer, "PAGEMAP") == 0) {
+        sendPageMap();
+        return;
+    }
+
+    if (strncmp(s_buffer, "POLL ", 5) == 0) {
+        setPollMode(s_buffer + 5);
+        return;
+    }
+
+    if (strncmp(s_buffer, "TIMING ", 7) == 0) {
+        setTiming(s_buffer + 7);
+        return;
+    }
+
+    if (strncmp(s_buffer, "STATS", 5) == 0) {
+        sendStats(s_buffer + 5);
+        return;
+    }
+
+    if (strcmp(s_buffer, "TWC") == 0) {
+        sendWriteCycleStats();
+        return;
+    }
+
+    if (strcmp(s_buffer, "INFO") == 0) {
+        sendInfo();
+        return;
+    }
+
+    if (strncmp(s_buffer, "READ ", 5) == 0) {
+        sendRange(s_buffer + 5);
+        return;
+    }
+
+    if (strncmp(s_buffer, "CHECKSUM ", 9) == 0) {
+        sendChecksum(s_buffer + 9);
+        return;
+    }
+
+    // Stay active. The host sees the NAK, and can carry on or END the
+    // session, which is all an error state would leave it able to do.
+    nak("Unexpected in active state", s_buffer);
+    linkError();
+}
+
+// Reads the whole ROM and sends back a CRC16 for each page, so the host can
+// work out which pages need writing without having to send them all first.
+//
+//   MAP:<first page>:<crc><crc>...
+//
+// Each MAP line covers c_pageMapLineSize pages, with the page number and CRCs
+// as 4-digit hex.
+static void sendPageMap() {
+    const uint8_t c_pageMapLineSize = 16;
+    uint8_t page[c_pageSize];
+
+    for (uint16_t pageNum = 0; pageNum < c_pageCount; pageNum++) {
+        ebError status = eb_readPage(pageNum * c_pageSize, page, c_pageSize);
+        if (status != ebError_OK) {
+            nak("Page map failed", eb_errorMessage(status));
+            return;
+        }
+
+        if (pageNum % c_pageMapLineSize == 0) {
+            Serial.print("MAP:");
+            printHex16(pageNum);
+            Serial.print(":");
+        }
+
+        printHex16(crc16(page, c_pageSize));
+
+        if (pageNum % c_pageMapLineSize == c_pageMapLineSize - 1) {
+            Serial.print("\n");
+        }
+    }
+
+    ack("PAGEMAP");
+}
+
+// Whether start and size, as the host sent them, make a range of at least
+// one byte inside the ROM. Checked this way round so a huge start or size
+// can't wrap the sum back into range.
+static bool validRange(uint32_t start, uint32_t size) {
+    return size != 0 && start < c_romSize && size <= c_romSize - start;
+}
+
+// READ start size
+//
+// Streams size bytes of the ROM from start, as raw bytes. Both numbers are in
+// hex. The data is preceded by a DATA:<size> line, so the host knows it's
+// coming, and followed by an ACK.
+static void sendRange(const char* args) {
+    char* end;
+    uint32_t start = strtoul(args, &end, 16);
+    uint32_t size  = strtoul(end, &end, 16);
+
+    if (*end != 0 || !validRange(start, size)) {
+        nak("Invalid read range", args);
+        return;
+    }
+
+    Serial.print("DATA:");
+    Serial.print(size, HEX);
+    Serial.print("\n");
+
+    ebError status = eb_readRange(start, size, sendByte);
+    if (status != ebError_OK) {
+        // We've already promised the host some data, but it will time out
+        // waiting for it, and then see this.
+        nak("Read failed", eb_errorMessage(status));
+        return;
+    }
+
+    ack("READ");
+}
+
+static void sendByte(uint8_t data) {
+    Serial.write(data);
+}
+
+// CHECKSUM start size
+//
+// Reads size bytes of the ROM from start, both in hex, and replies with their
+// CRC32, so the host can check what it wrote without sending it all again.
+//
+//   ACK:CHECKSUM:<crc32>
+static uint32_t s_checksum;
+
+static void sendChecksum(const char* args) {
+    char* end;
+    uint32_t start = strtoul(args, &end, 16);
+    uint32_t size  = strtoul(end, &end, 16);
+
+    if (*end != 0 || !validRange(start, size)) {
+        nak("Invalid checksum range", args);
+        return;
+    }
+
+    s_checksum = c_crc32Initial;
+    ebError status = eb_readRange(start, size, checksumByte);
+    if (status != ebError_OK) {
+        nak("Checksum failed", eb_errorMessage(status));
+        return;
+    }
+    uint32_t crc = crc32Final(s_checksum);
+
+    Serial.print("ACK:CHECKSUM:");
+    printHex16(crc >> 16);
+    printHex16(crc);
+    Serial.print("\n");
+}
+
+static void checksumByte(uint8_t data) {
+    s_checksum = crc32Update(s_checksum, data);
+}
+
+// FILL start size value
+//
+// Sets size bytes from start to value, all in hex, without the host having
+// to send them. Each page is burned once, and only if it doesn't already
+// match. Partial pages at either end keep the rest of their contents. Replies
+// with the number of pages that needed writing:
+//
+//   ACK:FILL:<pages>
+static void fillRange(const char* args) {
+    char* end;
+    uint32_t start = strtoul(args, &end, 16);
+    uint32_t size  = strtoul(end, &end, 16);
+    uint32_t value = strtoul(end, &end, 16);
+
+    if (*end != 0 || !validRange(start, size) || value > 0xff) {
+        nak("Invalid fill", args);
+        return;
+    }
+
+    uint8_t page[c_pageSize];
+    uint16_t written = 0;
+    for (uint32_t address = start; address < start + size; ) {
+        uint16_t pageAddress = address & ~(c_pageSize - 1);
+        uint8_t offset = address - pageAddress;
+        uint8_t count = c_pageSize - offset;
+        if (start + size - address < count) {
+            count = start + size - address;
+        }
+
+        if (count < c_pageSize) {
+            ebError status = eb_readPage(pageAddress, page, c_pageSize);
+            if (status != ebError_OK) {
+                nak("Fill failed", eb_errorMessage(status));
+                return;
+            }
+        }
+        memset(page + offset, value, count);
+
+        PageOp done = burnPage(pageAddress, page, c_pageSize);
+        if (done == 0) {
+            return;
+        }
+        if (done == WritePage) {
+            written++;
+        }
+        address += count;
+    }
+
+    Serial.print("ACK:FILL:");
+    Serial.print(written, DEC);
+    Serial.print("\n");
+}
+
+// POLL TOGGLE|DATA|DELAY
+//
+// Selects how the end of each page write is detected. BEGIN resets it to
+// TOGGLE.
+static void setPollMode(const char* mode) {
+    if (strcmp(mode, "TOGGLE") == 0) {
+        eb_setPollMode(ebPollMode_Toggle);
+    }
+    else if (strcmp(mode, "DATA") == 0) {
+        eb_setPollMode(ebPollMode_Data);
+    }
+    else if (strcmp(mode, "DELAY") == 0) {
+        eb_setPollMode(ebPollMode_Delay);
+    }
+    else {
+        nak("Unknown poll mode", mode);
+        return;
+    }
+    ack("POLL");
+}
+
+// BAUD rate
+//
+// Switches to a new rate, in decimal, after ACKing at the old one:
+//
+//   ACK:BAUD:<rate>
+//
+// The host then has c_baudSyncMillis to send SYNC at the new rate. We only
+// take rates the UART can get within 3% of, which rules out 230400 on a
+// 16 MHz part, but allows 250000, 500000, 1000000 and 2000000.
+static void setBaud(const char* args) {
+    char* end;
+    uint32_t baud = strtoul(args, &end, 10);
+    if (*end != 0 || baud < 9600 || baud > F_CPU / 8) {
+        nak("Invalid baud rate", args);
+        return;
+    }
+
+    // This is what HardwareSerial::begin ends up with, in double speed mode.
+    uint32_t divisor = (F_CPU / 4 / baud - 1) / 2 + 1;
+    uint32_t actual = F_CPU / 8 / divisor;
+    uint32_t error = actual > baud ? actual - baud : baud - actual;
+    if (error * 33 > baud) {
+        nak("Unsupported baud rate", args);
+        return;
+    }
+
+    Serial.print("ACK:BAUD:");
+    Serial.print(baud, DEC);
+    Serial.print("\n");
+    switchBaud(baud);
+    s_baudSynced = false;
+}
+
+static void switchBaud(uint32_t baud) {
+    if (baud == s_baud) {
+        return;
+    }
+
+    // Let the last reply go out at the old rate.
+    Serial.flush();
+    Serial.end();
+    Serial.begin(baud);
+
+    s_baud = baud;
+    s_baudSynced = true;
+    s_lastCommandMillis = millis();
+}
+
+// Garbage on the link, which at a raised rate probably means the host has
+// gone back to the default.
+static void linkError() {
+    s_counters.linkErrors++;
+    switchBaud(c_defaultBaud);
+}
+
+// TIMING ON|OFF
+//
+// Turns the phase times on page ACKs on or off. BEGIN turns them off.
+static void setTiming(const char* mode) {
+    if (strcmp(mode, "ON") == 0) {
+        s_timing = true;
+    }
+    else if (strcmp(mode, "OFF") == 0) {
+        s_timing = false;
+    }
+    else {
+        nak("Unknown timing mode", mode);
+        return;
+    }
+    ack("TIMING");
+}
+
+// STATS [RESET]
+//
+// Reports the running totals as one line of name=value pairs:
+//
+//   ACK:STATS:written=<n>,verified=<n>,...
+//
+// STATS RESET clears them, and replies with what they were.
+static void sendStats(const char* args) {
+    if (*args == ' ') {
+        args++;
     }
-    else if (s_buffer[0] == 'V') {
-        op = VerifyPage;
+    bool reset = strcmp(args, "RESET") == 0;
+    if (!reset && *args != 0) {
+        nak("Unknown stats option", args);
+        return;
+    }
+
+    ebCounters eb;
+    eb_getCounters(&eb);
+
+    Serial.print("ACK:STATS:written=");
+    Serial.print(s_counters.pagesWritten, DEC);
+    Serial.print(",verified=");
+    Serial.print(s_counters.pagesVerified, DEC);
+    Serial.print(",retries=");
+    Serial.print(s_counters.writeRetries, DEC);
+    Serial.print(",polls=");
+    Serial.print(eb.polls, DEC);
+    Serial.print(",maxPolls=");
+    Serial.print(eb.maxPolls, DEC);
+    Serial.print(",timeouts=");
+    Serial.print(eb.timeouts, DEC);
+    Serial.print(",mismatches=");
+    Serial.print(eb.mismatches, DEC);
+    Serial.print(",parseErrors=");
+    Serial.print(s_counters.parseErrors, DEC);
+    Serial.print(",rxFull=");
+    Serial.print(s_counters.rxFull, DEC);
+    Serial.print(",lineOverruns=");
+    Serial.print(s_counters.lineOverruns, DEC);
+    Serial.print(",rxTimeouts=");
+    Serial.print(s_counters.rxTimeouts, DEC);
+    Serial.print(",linkErrors=");
+    Serial.print(s_counters.linkErrors, DEC);
+    Serial.print("\n");
+
+    if (reset) {
+        memset(&s_counters, 0, sizeof(s_counters));
+        eb_resetCounters();
+    }
+}
+
+// TWC
+//
+// Reports the write cycle times seen since BEGIN, in microseconds, and the
+// average from the last session that wrote anything, so the host has a
+// measured figure to plan with before it's written a page:
+//
+//   ACK:TWC:<pages>:<min>:<avg>:<max>:<last avg>
+static void sendWriteCycleStats() {
+    ebWriteCycleStats stats;
+    eb_getWriteCycleStats(&stats);
+
+    uint32_t avgUs = stats.count > 0 ? stats.totalUs / stats.count : 0;
+    uint16_t minUs = stats.count > 0 ? stats.minUs : 0;
+
+    Serial.print("ACK:TWC:");
+    Serial.print(stats.count, DEC);
+    Serial.print(":");
+    Serial.print(minUs, DEC);
+    Serial.print(":");
+    Serial.print(avgUs, DEC);
+    Serial.print(":");
+    Serial.print(stats.maxUs, DEC);
+    Serial.print(":");
+    Serial.print(stats.lastAvgUs, DEC);
+    Serial.print("\n");
+}
+
+// INFO
+//
+// Says which chip the firmware was built for, so the host can check it has
+// the same idea of the page size and how big the ROM is:
+//
+//   ACK:INFO:chip=28C256,size=32768,page=64,twc=10000,erase=1
+static void sendInfo() {
+    Serial.print("ACK:INFO:chip=");
+    Serial.print(c_chip.name);
+    Serial.print(",size=");
+    Serial.print(c_romSize, DEC);
+    Serial.print(",page=");
+    Serial.print(c_pageSize, DEC);
+    Serial.print(",twc=");
+    Serial.print(c_chip.writeCycleUs, DEC);
+    Serial.print(",erase=");
+    Serial.print(c_chip.chipErase ? 1 : 0, DEC);
+    Serial.print("\n");
+}
+
+// STAGE ON|OFF
+//
+// Turns page staging on or off. BEGIN and END turn it off.
+static void setStaging(const char* mode) {
+    if (strcmp(mode, "ON") == 0) {
+        s_staging = true;
+    }
+    else if (strcmp(mode, "OFF") == 0) {
+        s_staging = false;
     }
     else {
-        nak("Unexpected in active state", s_buffer);
-        // TODO - error state?
+        nak("Unknown stage mode", mode);
         return;
     }
+    ack("STAGE");
+}
 
-    // If we get here, we're either writing or verifying an srec.
-    SRec1* s1 = parseSRec1(s_buffer+1, strlen(s_buffer+1));
-    if (s1 == NULL) {
-        nak("Invalid srecord", s_buffer);
-        // TODO - error state?
+static void pageOp(PageOp op, uint16_t address, const uint8_t* data, uint8_t size, int16_t seq) {
+    if (s_staging && op == WritePage) {
+        stageOp(address, data, size, seq);
         return;
     }
 
-    // In both write and verify case, verify the page first.
-    if (eb_verifyPage(s1->address, s1->data, s1->dataSize)) {
-        // If the page matches already, ack with a Verify
-        ack(s1, VerifyPage);
+    if (!commitStage()) {
         return;
     }
 
     if (op == VerifyPage) {
-        nak("Verify failed");
+        uint32_t verifyStart = micros();
+        bool matched = eb_verifyPage(address, data, size);
+        s_phases.verifyUs = clampUs(micros() - verifyStart);
+        if (matched) {
+            ack(VerifyPage, address, size, seq);
+        }
+        else {
+            nak("Verify failed");
+        }
         return;
     }
 
+    PageOp done = burnPage(address, data, size, op != ForcePage);
+    if (done != 0) {
+        ack(done, address, size, seq);
+    }
+}
+
+// Merges the data into the staged page, and acks it as S. If the data is for
+// a different page, the staged one is burned first.
+static void stageOp(uint16_t address, const uint8_t* data, uint8_t size, int16_t seq) {
+    int16_t page = address >> c_pageBits;
+    if (size == 0 || ((address + size - 1) >> c_pageBits) != page) {
+        nak("Stage failed", eb_errorMessage(ebError_PageBoundaryCrossed));
+        return;
+    }
+
+    if (page != s_stagePage) {
+        if (!commitStage()) {
+            return;
+        }
+
+        // Anything the host doesn't send keeps its current contents.
+        ebError status = eb_readPage(page << c_pageBits, s_stage, c_pageSize);
+        if (status != ebError_OK) {
+            nak("Stage failed", eb_errorMessage(status));
+            return;
+        }
+        s_stagePage = page;
+    }
+
+    memcpy(s_stage + (address & (c_pageSize - 1)), data, size);
+    ack(StagePage, address, size, seq);
+}
+
+// Burns the staged page, if there is one, and reports it as:
+//
+//   PAGE:<W|V>:<address>
+//
+// V means the ROM already matched. Returns false if the write failed, in
+// which case we've NAKed instead.
+static bool commitStage() {
+    if (s_stagePage < 0) {
+        return true;
+    }
+
+    uint16_t address = s_stagePage << c_pageBits;
+    s_stagePage = -1;
+
+    PageOp done = burnPage(address, s_stage, c_pageSize);
+    if (done == 0) {
+        return false;
+    }
+
+    Serial.print("PAGE:");
+    Serial.print(char(done));
+    Serial.print(":");
+    Serial.print(address, HEX);
+    Serial.print("\n");
+    return true;
+}
+
+// Writes the page, unless it already matches. Returns WritePage or VerifyPage
+// to say which, or zero if the write failed, in which case we've NAKed. If
+// the host already knows the page has changed, verifyFirst skips the check.
+static PageOp burnPage(uint16_t address, const uint8_t* data, uint8_t size, bool verifyFirst) {
+    // Verify the page first. If it matches already, there's nothing to do.
+    if (verifyFirst) {
+        uint32_t verifyStart = micros();
+        bool matched = eb_verifyPage(address, data, size);
+        s_phases.verifyUs = clampUs(micros() - verifyStart);
+        if (matched) {
+            s_counters.pagesVerified++;
+            return VerifyPage;
+        }
+    }
+
     int retries = 0;
     while (1) {
-        ebError status = eb_writePage(s1->address, s1->data, s1->dataSize);
+        ebError status = eb_writePage(address, data, size);
+
+        ebPageTiming timing;
+        eb_getPageTiming(&timing);
+        s_phases.loadUs = timing.loadUs;
+        s_phases.waitUs = timing.waitUs;
+
         if (status == ebError_OK) {
             // All good :+1:
-            ack(s1, WritePage);
-            return;
+            s_counters.pagesWritten++;
+            return WritePage;
         }
 
         // If write page failed, delay, and then see if it wrote anyway.
         delay(1);
-        if (eb_verifyPage(s1->address, s1->data, s1->dataSize, true)) {
+        if (eb_verifyPage(address, data, size, true)) {
             msg("Write failed, but verified ok");
-            ack(s1, WritePage);
-            return;
+            s_counters.pagesWritten++;
+            return WritePage;
         }
 
         if (++retries > 5) {
             nak("Write failed", eb_errorMessage(status));
-            return;
+            return PageOp(0);
         }
         else {
+            s_counters.writeRetries++;
             msg("Write and verify failed - retrying");
         }
     }
@@ -176,16 +969,41 @@ static void ack(const char* message) {
     Serial.print("\n");
 }
 
-static void ack(const SRec1* srec, PageOp op) {
+static void ack(PageOp op, uint16_t address, uint8_t size, int16_t seq) {
     Serial.print("ACK:");
     Serial.print(char(op));
     Serial.print(":");
-    Serial.print(srec->address, HEX);
+    Serial.print(address, HEX);
     Serial.print(":");
-    Serial.print(srec->dataSize, DEC);
+    Serial.print(size, DEC);
+    if (seq != c_noSeq) {
+        Serial.print(":");
+        Serial.print(seq, DEC);
+    }
+    if (s_timing) {
+        Serial.print(" T=");
+        Serial.print(s_phases.receiveUs, DEC);
+        Serial.print(",");
+        Serial.print(s_phases.parseUs, DEC);
+        Serial.print(",");
+        Serial.print(s_phases.verifyUs, DEC);
+        Serial.print(",");
+        Serial.print(s_phases.loadUs, DEC);
+        Serial.print(",");
+        Serial.print(s_phases.waitUs, DEC);
+    }
     Serial.print("\n");
 }
 
+static void startPhases() {
+    memset(&s_phases, 0, sizeof(s_phases));
+    s_phases.receiveUs = clampUs(rx_receiveUs());
+}
+
+static uint16_t clampUs(uint32_t us) {
+    return us > 0xffff ? 0xffff : us;
+}
+
 static void nak(const char* message) {
     Serial.print("NAK:");
     Serial.print(message);
@@ -206,24 +1024,8 @@ static void msg(const char* message) {
     Serial.print("\n");
 }
 
-// Reads bytes until the terminator is reached, or we hit the end of the buffer,
-// or the timeout elapses between bytes being received. Each time a character
-// is received, the timeout is extended.
-static uint16_t readBytesUntil(char terminator, char *buffer, size_t length, uint32_t timeout) {
-    uint32_t startMillis = millis();
-    uint16_t index = 0;
-    while ((index < length) && (millis() - startMillis < timeout)) {
-        int c = Serial.read();
-        if (c < 0)
-            continue;
-
-        startMillis = millis(); // we got a character - reset the timer
-
-        *buffer++ = (char)c;
-        index++;
-
-        if (c == terminator)
-            break;
+static void printHex16(uint16_t value) {
+    for (int8_t shift = 12; shift >= 0; shift -= 4) {
+        Serial.print((value >> shift) & 0xf, HEX);
     }
-    return index; // return number of characters
 }
@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include <stdio.h>
+
+static uint64_t s_cycles = 0;
+
+uint64_t sim_cycles() {
+    return s_cycles;
+}
+
+void sim_advance(uint32_t cycles) {
+    s_cycles += cycles;
+}
+
+// Reading the clock isn't free on the nano either. Charging for it also
+// means loops that spin on millis() or micros() see time move.
+const uint32_t Cycles_ReadClock = 50;
+
+unsigned long millis() {
+    s_cycles += Cycles_ReadClock;
+    return s_cycles / (c_simClockHz / 1000);
+}
+
+unsigned long micros() {
+    s_cycles += Cycles_ReadClock;
+    return s_cycles / (c_simClockHz / 1000000);
+}
+
+void delay(unsigned long ms) {
+    s_cycles += (uint64_t)ms * (c_simClockHz / 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    s_cycles += (uint64_t)us * (c_simClockHz / 1000000);
+}
+
+// Serial goes to the link if there is one. Otherwise output goes to stdout,
+// and there is no input.
+HardwareSerial Serial;
+static SimSerialLink* s_link = NULL;
+
+void sim_setSerialLink(SimSerialLink* link) {
+    s_link = link;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+    if (s_link != NULL) {
+        s_link->begin(baud);
+    }
+}
+
+void HardwareSerial::end() {
+    if (s_link != NULL) {
+        s_link->end();
+    }
+}
+
+void HardwareSerial::flush() {
+    if (s_link != NULL) {
+        s_link->flush();
+    }
+    else {
+        fflush(stdout);
+    }
+}
+
+int HardwareSerial::available()             { return s_link != NULL ? s_link->available() : 0; }
+int HardwareSerial::peek()                  { return s_link != NULL ? s_link->peek() : -1; }
+int HardwareSerial::read()                  { return s_link != NULL ? s_link->read() : -1; }
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (s_link != NULL) {
+        s_link->write(c);
+        return 1;
+    }
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    if (s_link != NULL) {
+        for (size_t i = 0; i < size; i++) {
+            s_link->write(buffer[i]);
+        }
+        return size;
+    }
+    return fwrite(buffer, 1, size, stdout);
+}
+
+size_t HardwareSerial::print(const char* s) {
+    return write((const uint8_t*) s, strlen(s));
+}
+
+size_t HardwareSerial::print(char c) {
+    return write((uint8_t) c);
+}
+
+size_t HardwareSerial::print(unsigned char n, int base) {
+    return printNumber(n, base);
+}
+
+size_t HardwareSerial::print(int n, int base) {
+    return print((long) n, base);
+}
+
+size_t HardwareSerial::print(unsigned int n, int base) {
+    return printNumber(n, base);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+    // Like the real thing, only decimal numbers get a minus sign.
+    if (base == DEC && n < 0) {
+        return print('-') + printNumber(-n, base);
+    }
+    return printNumber(n, base);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+    return printNumber(n, base);
+}
+
+size_t HardwareSerial::println(const char* s) {
+    return print(s) + println();
+}
+
+size_t HardwareSerial::println() {
+    return print("\r\n");
+}
+
+size_t HardwareSerial::printNumber(unsigned long n, int base) {
+    char buffer[8 * sizeof(long) + 1];
+    char* str = &buffer[sizeof(buffer) - 1];
+    *str = 0;
+
+    do {
+        uint8_t digit = n % base;
+        *--str = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        n /= base;
+    } while (n != 0);
+
+    return print(str);
+}
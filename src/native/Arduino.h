@@ -0,0 +1,85 @@
+#ifndef INCLUDE_NATIVE_ARDUINO_H
+#define INCLUDE_NATIVE_ARDUINO_H
+
+// Just enough of the Arduino API to build the burner on the host. Time is
+// simulated: it only moves forward when something calls sim_advance, or one
+// of the delay functions.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEX 16
+#define DEC 10
+
+// Flash and RAM are all the same on the host.
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*) (address))
+
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+// The simulated clock runs at the nano's 16 MHz.
+#define F_CPU 16000000UL
+const uint32_t c_simClockHz = F_CPU;
+
+extern uint64_t sim_cycles();
+extern void sim_advance(uint32_t cycles);
+
+extern unsigned long millis();
+extern unsigned long micros();
+extern void delay(unsigned long ms);
+extern void delayMicroseconds(unsigned int us);
+
+// Same as the boards in platformio.ini.
+#if !defined(SERIAL_RX_BUFFER_SIZE)
+    #define SERIAL_RX_BUFFER_SIZE 256
+#endif
+
+// Serial talks to a SimSerialLink when there is one, which is how
+// native/replay.cpp drives main.cpp. Without one, output goes to stdout and
+// there is no input.
+class SimSerialLink {
+public:
+    virtual void begin(unsigned long baud) = 0;
+    virtual void end() = 0;
+    virtual void flush() = 0;
+    virtual int available() = 0;
+    virtual int peek() = 0;
+    virtual int read() = 0;
+    virtual void write(uint8_t c) = 0;
+};
+
+extern void sim_setSerialLink(SimSerialLink* link);
+
+class HardwareSerial {
+public:
+    void begin(unsigned long baud);
+    void end();
+    void flush();
+
+    int available();
+    int peek();
+    int read();
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+
+    size_t print(const char* s);
+    size_t print(char c);
+    size_t print(unsigned char n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+
+    size_t println(const char* s);
+    size_t println();
+
+private:
+    size_t printNumber(unsigned long n, int base);
+};
+
+extern HardwareSerial Serial;
+
+#endif // INCLUDE_NATIVE_ARDUINO_H
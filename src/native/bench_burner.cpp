@@ -0,0 +1,184 @@
+// Runs the burner against the simulated AT28C256, and reports the simulated
+// cycles each operation takes per page. Exits non-zero if the chip doesn't
+// end up with the right contents.
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "eeprom_burner.h"
+#include "sim28c256.h"
+
+static uint8_t s_image[c_romSize];
+static int s_failures = 0;
+
+static void report(const char* name, uint32_t pages, uint64_t cycles) {
+    printf("%-28s %4u pages %10llu cycles %8llu cycles/page %8.1f us/page\n",
+        name, pages, (unsigned long long) cycles,
+        (unsigned long long) (cycles / pages),
+        (double) cycles / pages / (c_simClockHz / 1000000));
+}
+
+static void fail(const char* message, uint16_t address) {
+    printf("FAIL: %s at 0x%04x\n", message, address);
+    s_failures++;
+}
+
+static void checkContents(const char* when) {
+    for (uint16_t address = 0; address < c_romSize; address++) {
+        if (sim_peek(address) != s_image[address]) {
+            fail(when, address);
+            return;
+        }
+    }
+}
+
+// The first call to the poll hook after a page write starts marks the end of
+// the page load.
+static uint64_t s_loadStart;
+static uint64_t s_loadCycles;
+static bool s_loading;
+
+static void pollHook() {
+    if (s_loading) {
+        s_loadCycles += sim_cycles() - s_loadStart;
+        s_loading = false;
+    }
+}
+
+static void benchWrite(const char* name, uint8_t size) {
+    s_loadCycles = 0;
+    eb_setPollHook(pollHook);
+
+    uint64_t start = sim_cycles();
+    for (uint16_t address = 0; address < c_romSize; address += size) {
+        s_loadStart = sim_cycles();
+        s_loading = true;
+        ebError status = eb_writePage(address, s_image + address, size);
+        if (status != ebError_OK) {
+            fail(eb_errorMessage(status), address);
+            return;
+        }
+    }
+    // Per page however it was split up, so partial writes compare with whole
+    // ones.
+    report(name, c_pageCount, sim_cycles() - start);
+    printf("%-28s %4u pages   load %llu cycles/byte\n", "", c_pageCount,
+        (unsigned long long) (s_loadCycles / c_romSize));
+
+    eb_setPollHook(NULL);
+}
+
+static void invertImage() {
+    for (uint16_t address = 0; address < c_romSize; address++) {
+        s_image[address] = ~s_image[address];
+    }
+}
+
+// polls is the number of polls before the pages were written.
+static void reportWriteCycles(uint32_t polls) {
+    ebWriteCycleStats stats;
+    eb_getWriteCycleStats(&stats);
+    if (stats.count > 0) {
+        printf("%-28s %4u pages   tWC min %u us, avg %u us, max %u us\n", "",
+            stats.count, stats.minUs, (unsigned) (stats.totalUs / stats.count),
+            stats.maxUs);
+    }
+    ebCounters counters;
+    eb_getCounters(&counters);
+    printf("%-28s %4u pages   %u polls/page\n", "", c_pageCount,
+        (unsigned) ((counters.polls - polls) / c_pageCount));
+}
+
+// Verbose verifies use the generic loop rather than the full page kernel.
+static void benchVerify(const char* name, bool verbose) {
+    uint64_t start = sim_cycles();
+    for (uint16_t address = 0; address < c_romSize; address += c_pageSize) {
+        if (!eb_verifyPage(address, s_image + address, c_pageSize, verbose)) {
+            fail("verify failed", address);
+            return;
+        }
+    }
+    report(name, c_pageCount, sim_cycles() - start);
+}
+
+// Reads the whole ROM with eb_readRange, as READ and CHECKSUM do, and checks
+// it against the image.
+static uint16_t s_readAddress;
+
+static void readSink(uint8_t data) {
+    if (data != s_image[s_readAddress]) {
+        fail("read mismatch", s_readAddress);
+    }
+    s_readAddress++;
+}
+
+static void benchRead(const char* name) {
+    s_readAddress = 0;
+    uint64_t start = sim_cycles();
+    ebError status = eb_readRange(0, c_romSize, readSink);
+    if (status != ebError_OK) {
+        fail(eb_errorMessage(status), 0);
+        return;
+    }
+    report(name, c_pageCount, sim_cycles() - start);
+}
+
+int main() {
+    sim_reset();
+    eb_init();
+    eb_beginSession();
+
+    srand(6502);
+    for (uint16_t address = 0; address < c_romSize; address++) {
+        s_image[address] = rand();
+    }
+
+    static const struct {
+        ebPollMode mode;
+        const char* name;
+    } c_pollModes[] = {
+        { ebPollMode_Toggle,    "write full pages (DQ6)" },
+        { ebPollMode_Data,      "write full pages (DQ7)" },
+        { ebPollMode_Delay,     "write full pages (delay)" },
+    };
+
+    for (auto& pollMode : c_pollModes) {
+        eb_beginSession();
+        eb_setPollMode(pollMode.mode);
+        invertImage();
+        ebCounters counters;
+        eb_getCounters(&counters);
+        benchWrite(pollMode.name, c_pageSize);
+        reportWriteCycles(counters.polls);
+        checkContents(pollMode.name);
+    }
+    eb_setPollMode(ebPollMode_Toggle);
+
+    benchVerify("verify full pages", false);
+    benchVerify("verify full pages (generic)", true);
+    benchRead("read range");
+
+    invertImage();
+    benchWrite("write 16 byte records", 16);
+    checkContents("after 16 byte record write");
+
+    if (c_chip.chipErase) {
+        uint64_t start = sim_cycles();
+        ebError status = eb_chipErase();
+        if (status != ebError_OK) {
+            fail(eb_errorMessage(status), 0);
+        }
+        report("chip erase", c_pageCount, sim_cycles() - start);
+        memset(s_image, 0xff, sizeof(s_image));
+        checkContents("after chip erase");
+    }
+
+    eb_endSession(false);
+
+    const SimStats& stats = sim_stats();
+    printf("\nsimulated chip: %u byte loads, %u page writes, %u busy reads, "
+           "%u ignored loads, %u page violations, %u erases\n",
+        stats.byteLoads, stats.pageWrites, stats.busyReads,
+        stats.ignoredLoads, stats.pageViolations, stats.erases);
+
+    return s_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+// Checks decodeSRec1 against a simple parser of whole lines, on random valid
+// records and on mangled ones, then reports how fast it decodes. Exits
+// non-zero if the two ever disagree.
+
+#include <Arduino.h>
+#include <chrono>
+#include <ctype.h>
+#include <stdio.h>
+#include "srec.h"
+
+// S1, then the byte count, address, data and checksum as hex, and a NUL.
+const size_t c_maxLine = 2 + (1 + 2 + c_srecMaxData + 1) * 2 + 1;
+
+// Room for a few characters inserted by mutate.
+const size_t c_maxMutated = c_maxLine + 4;
+
+static int s_failures = 0;
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = toupper(c);
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// The reference: parses the whole line at once, the obvious way.
+static bool parseLine(const char* line, SRec1* record) {
+    size_t length = strlen(line);
+    if (length < 4 || line[0] != 'S' || line[1] != '1' || length % 2 != 0) {
+        return false;
+    }
+
+    uint8_t bytes[c_maxMutated / 2];
+    size_t count = (length - 2) / 2;
+    if (count > sizeof(bytes)) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        int high = hexValue(line[2 + i * 2]);
+        int low = hexValue(line[3 + i * 2]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        bytes[i] = high << 4 | low;
+    }
+
+    // Byte count, address, data, checksum.
+    if (bytes[0] != count - 1 || bytes[0] < 3 || bytes[0] - 3 > c_srecMaxData) {
+        return false;
+    }
+    uint8_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += bytes[i];
+    }
+    if (sum != 0xff) {
+        return false;
+    }
+
+    record->dataSize = bytes[0] - 3;
+    record->address = bytes[1] << 8 | bytes[2];
+    memcpy(record->data, bytes + 3, record->dataSize);
+    return true;
+}
+
+static bool decodeLine(const char* line, SRec1Decoder* decoder) {
+    beginSRec1(decoder);
+    SRecStatus status = srecStatus_More;
+    for (const char* c = line; *c != 0; c++) {
+        status = decodeSRec1(decoder, *c);
+    }
+    return status == srecStatus_Ready;
+}
+
+static void check(const char* line) {
+    SRec1 expected;
+    SRec1Decoder decoder;
+    bool valid = parseLine(line, &expected);
+    bool decoded = decodeLine(line, &decoder);
+
+    const SRec1& got = decoder.record;
+    if (valid != decoded
+            || (valid && (got.dataSize != expected.dataSize
+                          || got.address != expected.address
+                          || memcmp(got.data, expected.data, got.dataSize) != 0))) {
+        if (s_failures < 10) {
+            printf("FAIL: %s: expected %s, decoder says %s\n", line,
+                valid ? "valid" : "invalid", decoded ? "valid" : "invalid");
+        }
+        s_failures++;
+    }
+}
+
+// A valid record with random contents, in upper or lower case.
+static void randomRecord(char* line, uint8_t dataSize, bool lower) {
+    const char* digits = lower ? "0123456789abcdef" : "0123456789ABCDEF";
+    uint8_t bytes[c_srecMaxData + 4];
+    uint8_t count = dataSize + 3;
+    bytes[0] = count;
+    uint8_t sum = count;
+    for (uint8_t i = 1; i < count; i++) {
+        bytes[i] = rand();
+        sum += bytes[i];
+    }
+    bytes[count] = ~sum;
+
+    char* out = line;
+    *out++ = 'S';
+    *out++ = '1';
+    for (uint8_t i = 0; i <= count; i++) {
+        *out++ = digits[bytes[i] >> 4];
+        *out++ = digits[bytes[i] & 0x0f];
+    }
+    *out = 0;
+}
+
+// Mangles the line one of several ways. Most, but not all, make it invalid.
+static void mutate(char* line) {
+    static const char c_chars[] = "0123456789ABCDEFabcdefGgSs1 :\x7f\xff";
+    size_t length = strlen(line);
+    size_t at = rand() % (length + 1);
+    char c = c_chars[rand() % (sizeof(c_chars) - 1)];
+    switch (rand() % 4) {
+    case 0:     // replace
+        if (at < length) {
+            line[at] = c;
+        }
+        break;
+    case 1:     // insert
+        memmove(line + at + 1, line + at, length - at + 1);
+        line[at] = c;
+        break;
+    case 2:     // delete
+        if (at < length) {
+            memmove(line + at, line + at + 1, length - at);
+        }
+        break;
+    case 3:     // truncate
+        line[at] = 0;
+        break;
+    }
+}
+
+// Each round checks a valid record, then a mangled copy of it.
+static void fuzz(uint32_t rounds) {
+    char line[c_maxMutated];
+    for (uint32_t i = 0; i < rounds; i++) {
+        randomRecord(line, rand() % (c_srecMaxData + 1), rand() % 2);
+        check(line);
+        for (int mutations = rand() % 3 + 1; mutations > 0; mutations--) {
+            mutate(line);
+        }
+        check(line);
+    }
+    printf("fuzzed %u records, %d mismatches\n", rounds * 2, s_failures);
+}
+
+// Every byte count, including the ones that are too small or big, on records
+// that are otherwise fine.
+static void byteCounts() {
+    char line[c_maxMutated];
+    for (int count = 0; count < 256; count++) {
+        uint8_t dataSize = count < 3 ? 0 : (count - 3) % (c_srecMaxData + 1);
+        randomRecord(line, dataSize, false);
+        char digits[3];
+        snprintf(digits, sizeof(digits), "%02X", count);
+        line[2] = digits[0];
+        line[3] = digits[1];
+        check(line);
+    }
+}
+
+static void bench(uint32_t records) {
+    static char lines[64][c_maxLine];
+    for (int i = 0; i < 64; i++) {
+        randomRecord(lines[i], c_srecMaxData, false);
+    }
+    size_t length = strlen(lines[0]);
+
+    SRec1Decoder decoder;
+    uint32_t ready = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < records; i++) {
+        ready += decodeLine(lines[i % 64], &decoder);
+    }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+    if (ready != records) {
+        printf("FAIL: only %u of %u records decoded\n", ready, records);
+        s_failures++;
+    }
+    double chars = double(records) * length;
+    printf("decoded %u records of %u bytes: %.1f ns/char, %.1f Mchars/s\n",
+        records, c_srecMaxData, secs.count() * 1e9 / chars, chars / secs.count() / 1e6);
+}
+
+int main() {
+    srand(6502);
+    byteCounts();
+    fuzz(200000);
+    bench(200000);
+    return s_failures == 0 ? 0 : 1;
+}
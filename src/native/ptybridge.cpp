@@ -0,0 +1,246 @@
+// Runs main.cpp on a pseudo-terminal, with the simulated AT28C256 behind it,
+// so write-rom.py can be pointed at it like a real arduino:
+//
+//   program [--rom FILE] [--exit-after PAGES] [--link PATH] [--glitch BYTES]
+//
+// It prints the name of the terminal, then runs until it's killed. Like a
+// board write-rom.py has turned hupcl off for, it doesn't reset when the
+// port is opened, and the RESET it printed on starting up is never seen.
+//
+// --rom loads the chip from FILE, if there is one, and saves it back there on
+// exit. --exit-after exits after that many page writes, with frames still in
+// flight, as if the cable had been pulled. --link makes PATH a symlink to
+// the terminal, so the port keeps its name from one run to the next, like
+// the ones in /dev/serial/by-id. --glitch flips a bit in the byte that far
+// into what the host sends, like noise on the line. script/test-write-rom.py
+// uses all of them.
+
+#include <Arduino.h>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <termios.h>
+#include <unistd.h>
+#include "sim28c256.h"
+
+extern void setup();
+extern void loop();
+
+// Each trip round loop() costs something, even when there's nothing to do.
+const uint32_t Cycles_Loop = 20;
+
+// When there's nothing to do, wait this long for the host, in real time and
+// on the simulated clock. So the timeouts in main.cpp run at about the right
+// speed while it's idle.
+const int c_idleMs = 1;
+
+// HardwareSerial's receive ring, less the slot that tells full from empty.
+// Anything the host sends beyond that waits in the terminal rather than
+// being dropped, so this is kinder than the board.
+const size_t c_rxRingSize = SERIAL_RX_BUFFER_SIZE - 1;
+
+static volatile sig_atomic_t s_stop = 0;
+
+// The arduino's end of the terminal. Reads fail, and writes go nowhere, while
+// the host doesn't have it open.
+class PtyLink : public SimSerialLink {
+public:
+    int fd;
+    std::deque<uint8_t> ring;
+    uint32_t received;
+    uint32_t glitchAt;          // or 0 for none
+
+    PtyLink(int master, uint32_t glitch) : fd(master), received(0), glitchAt(glitch) { }
+
+    // Moves what's arrived into the ring, if there's room. Returns false if
+    // the host doesn't have the terminal open.
+    bool receive() {
+        uint8_t buffer[SERIAL_RX_BUFFER_SIZE];
+        size_t room = c_rxRingSize - ring.size();
+        if (room == 0) {
+            return true;
+        }
+        ssize_t got = ::read(fd, buffer, room);
+        if (got < 0) {
+            return errno == EAGAIN;
+        }
+        if (glitchAt > received && glitchAt <= received + got) {
+            buffer[glitchAt - received - 1] ^= 0x10;
+        }
+        received += got;
+        ring.insert(ring.end(), buffer, buffer + got);
+        return true;
+    }
+
+    void begin(unsigned long) override { }
+
+    void end() override {
+        ring.clear();
+    }
+
+    void flush() override { }
+
+    int available() override {
+        receive();
+        return ring.size();
+    }
+
+    int peek() override {
+        receive();
+        return ring.empty() ? -1 : ring.front();
+    }
+
+    int read() override {
+        receive();
+        if (ring.empty()) {
+            return -1;
+        }
+        uint8_t c = ring.front();
+        ring.pop_front();
+        return c;
+    }
+
+    // Waits for the host to make room, unless it's gone away.
+    void write(uint8_t c) override {
+        while (::write(fd, &c, 1) < 0 && errno == EAGAIN) {
+            struct pollfd p = { fd, POLLOUT, 0 };
+            if (poll(&p, 1, c_idleMs) > 0 && (p.revents & POLLHUP)) {
+                return;
+            }
+        }
+    }
+};
+
+static bool loadRom(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return errno == ENOENT;
+    }
+    uint8_t data[c_romSize];
+    bool ok = fread(data, 1, sizeof(data), f) == sizeof(data);
+    fclose(f);
+    for (uint16_t address = 0; ok && address < c_romSize; address++) {
+        sim_poke(address, data[address]);
+    }
+    return ok;
+}
+
+static bool saveRom(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    uint8_t data[c_romSize];
+    for (uint16_t address = 0; address < c_romSize; address++) {
+        data[address] = sim_peek(address);
+    }
+    bool ok = fwrite(data, 1, sizeof(data), f) == sizeof(data);
+    return fclose(f) == 0 && ok;
+}
+
+static void stop(int) {
+    s_stop = 1;
+}
+
+int main(int argc, char** argv) {
+    const char* romPath = NULL;
+    const char* linkPath = NULL;
+    uint32_t exitAfter = 0;
+    uint32_t glitch = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rom") == 0 && i + 1 < argc) {
+            romPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--exit-after") == 0 && i + 1 < argc) {
+            exitAfter = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--link") == 0 && i + 1 < argc) {
+            linkPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--glitch") == 0 && i + 1 < argc) {
+            glitch = strtoul(argv[++i], NULL, 10);
+        }
+        else {
+            fprintf(stderr, "usage: %s [--rom FILE] [--exit-after PAGES] [--link PATH] [--glitch BYTES]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    sim_reset();
+    if (romPath != NULL && !loadRom(romPath)) {
+        fprintf(stderr, "%s: can't load a %u byte ROM from it\n", romPath, c_romSize);
+        return 1;
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+    // A new terminal echoes, which would send the arduino's replies back to
+    // it before the host has set the port up. Make it raw to start with.
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios raw;
+    if (slave < 0 || tcgetattr(slave, &raw) != 0) {
+        perror(ptsname(master));
+        return 1;
+    }
+    cfmakeraw(&raw);
+    tcsetattr(slave, TCSANOW, &raw);
+    close(slave);
+
+    if (linkPath != NULL) {
+        unlink(linkPath);
+        if (symlink(ptsname(master), linkPath) != 0) {
+            perror(linkPath);
+            return 1;
+        }
+    }
+
+    printf("%s\n", linkPath != NULL ? linkPath : ptsname(master));
+    fflush(stdout);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    PtyLink link(master, glitch);
+    sim_setSerialLink(&link);
+    setup();
+
+    while (!s_stop) {
+        loop();
+        sim_advance(Cycles_Loop);
+
+        if (exitAfter > 0 && sim_stats().pageWrites >= exitAfter) {
+            break;
+        }
+
+        // With nothing to do, wait for the host. While it doesn't have the
+        // terminal open, poll says so straight away, so sleep instead.
+        bool open = link.receive();
+        if (link.ring.empty()) {
+            struct pollfd p = { master, POLLIN, 0 };
+            if (!open || poll(&p, 1, c_idleMs) < 0 || (p.revents & POLLHUP)) {
+                usleep(c_idleMs * 1000);
+            }
+            sim_advance(c_idleMs * (c_simClockHz / 1000));
+        }
+    }
+
+    sim_setSerialLink(NULL);
+    close(master);
+    if (linkPath != NULL) {
+        unlink(linkPath);
+    }
+    if (romPath != NULL && !saveRom(romPath)) {
+        fprintf(stderr, "%s: can't save the ROM\n", romPath);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,643 @@
+// Replays recorded sessions through main.cpp, with the simulated AT28C256
+// behind it, and checks that it says exactly what it said when they were
+// recorded. Also reports how long each took on the simulated clock, and fails
+// if that's gone over the transcript's limit.
+//
+//   replay [--update] [transcript...]
+//
+// With no transcripts, it runs all of them in src/native/transcripts, found
+// from where this was built, and fails if there are none. --update rewrites
+// them with what main.cpp says now, and sets each limit a little over the
+// time it took. Check the diff before committing that.
+//
+// A transcript is a text file, one chunk of bytes per line:
+//
+//   # comment
+//   limit <us>
+//   > what the host sent
+//   < what the arduino sent back
+//
+// Bytes that aren't printable are written as \n, \r, \\ or \xNN. Each > line
+// is sent after all the < lines before it have arrived, like a host waiting
+// for replies, so consecutive > lines are pipelined. write-rom.py --record
+// writes transcripts of real sessions in the same form.
+//
+// A session starts with the arduino already running, as write-rom.py finds
+// it with hupcl off, so the RESET it printed on starting up isn't part of it.
+//
+// --update keeps each > line after the same number of reply lines, so it
+// fails rather than guess if main.cpp now says more or fewer lines. When
+// writing a new transcript, or changing how many lines a reply has, put a
+// placeholder like "< ?\n" for each line the arduino should send.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <dirent.h>
+#include <stdio.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "sim28c256.h"
+
+extern void setup();
+extern void loop();
+
+// Where the transcripts are, next to this file. The build may name it
+// relative to the project, so failing that, try from the program in
+// .pio/build/native_replay, and from the project.
+const char* c_transcriptDir = "transcripts";
+const char* c_programToTranscripts = "../../../src/native/transcripts";
+const char* c_projectToTranscripts = "src/native/transcripts";
+
+// Each trip round loop() costs something, even when there's nothing to do.
+const uint32_t Cycles_Loop = 20;
+
+// How long the arduino can go without saying anything before we give up on
+// it, and how long it must stay quiet at the end.
+const uint64_t Cycles_Quiet = c_simClockHz * 2;
+const uint64_t Cycles_Settle = c_simClockHz / 10;
+
+// How many times --update goes round before giving up on it settling.
+const int c_updatePasses = 4;
+
+// The limit --update writes is this much over the time the replay took.
+const uint32_t c_limitPercent = 105;
+
+// HardwareSerial's transmit buffer, and its receive ring less the slot that
+// tells full from empty.
+const size_t c_txBufferSize = 64;
+const size_t c_rxRingSize = SERIAL_RX_BUFFER_SIZE - 1;
+
+struct Chunk {
+    bool host;
+    std::string bytes;
+};
+
+struct Transcript {
+    std::vector<std::string> comments;
+    uint32_t limitUs;
+    std::vector<Chunk> chunks;
+};
+
+// Both ends of the serial link, at 10 bits a byte. Bytes from the host arrive
+// in the receive ring at line rate, and are dropped if it's full. Bytes to
+// the host go out at line rate, and write blocks once the transmit buffer is
+// full, as it does on the board.
+class Link : public SimSerialLink {
+public:
+    struct Byte {
+        uint64_t cycle;     // when it arrives at the other end
+        uint8_t data;
+    };
+
+    std::deque<Byte> toDevice;
+    std::deque<uint8_t> ring;
+    std::vector<Byte> toHost;
+    uint32_t baud;
+    uint64_t hostDone;      // when the host's last byte arrives
+    uint64_t deviceDone;    // when the arduino's last byte arrives
+    uint32_t overruns;
+
+    Link() : baud(0), hostDone(0), deviceDone(0), overruns(0) { }
+
+    uint64_t byteCycles() const {
+        return c_simClockHz * 10 / baud;
+    }
+
+    // The host sends bytes, starting no earlier than cycle.
+    void send(const std::string& bytes, uint64_t cycle) {
+        uint64_t at = std::max(cycle, hostDone);
+        for (char c : bytes) {
+            at += byteCycles();
+            toDevice.push_back({ at, uint8_t(c) });
+        }
+        hostDone = at;
+    }
+
+    bool idle() {
+        receive();
+        return toDevice.empty() && ring.empty();
+    }
+
+    void begin(unsigned long rate) override {
+        baud = rate;
+    }
+
+    void end() override {
+        ring.clear();
+    }
+
+    void flush() override {
+        uint64_t now = sim_cycles();
+        if (deviceDone > now) {
+            sim_advance(deviceDone - now);
+        }
+    }
+
+    int available() override {
+        receive();
+        return ring.size();
+    }
+
+    int peek() override {
+        receive();
+        return ring.empty() ? -1 : ring.front();
+    }
+
+    int read() override {
+        receive();
+        if (ring.empty()) {
+            return -1;
+        }
+        uint8_t c = ring.front();
+        ring.pop_front();
+        return c;
+    }
+
+    void write(uint8_t c) override {
+        uint64_t now = sim_cycles();
+        uint64_t buffered = c_txBufferSize * byteCycles();
+        if (deviceDone > now + buffered) {
+            sim_advance(deviceDone - now - buffered);
+            now = sim_cycles();
+        }
+        deviceDone = std::max(deviceDone, now) + byteCycles();
+        toHost.push_back({ deviceDone, c });
+    }
+
+private:
+    void receive() {
+        uint64_t now = sim_cycles();
+        while (!toDevice.empty() && toDevice.front().cycle <= now) {
+            if (ring.size() < c_rxRingSize) {
+                ring.push_back(toDevice.front().data);
+            }
+            else {
+                overruns++;
+            }
+            toDevice.pop_front();
+        }
+    }
+};
+
+static std::string escape(const std::string& bytes) {
+    std::string out;
+    for (size_t i = 0; i < bytes.size(); i++) {
+        uint8_t c = bytes[i];
+        char hex[5];
+        if (c == '\n') {
+            out += "\\n";
+        }
+        else if (c == '\r') {
+            out += "\\r";
+        }
+        else if (c == '\\') {
+            out += "\\\\";
+        }
+        else if (c < 0x20 || c > 0x7e || (c == ' ' && i + 1 == bytes.size())) {
+            // A trailing space would be too easy to lose.
+            snprintf(hex, sizeof(hex), "\\x%02x", c);
+            out += hex;
+        }
+        else {
+            out += char(c);
+        }
+    }
+    return out;
+}
+
+static bool unescape(const std::string& text, std::string* bytes) {
+    bytes->clear();
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\') {
+            *bytes += text[i];
+            continue;
+        }
+        if (++i == text.size()) {
+            return false;
+        }
+        switch (text[i]) {
+        case 'n':   *bytes += '\n'; break;
+        case 'r':   *bytes += '\r'; break;
+        case '\\':  *bytes += '\\'; break;
+        case 'x':
+            if (i + 2 >= text.size()) {
+                return false;
+            }
+            *bytes += char(strtoul(text.substr(i + 1, 2).c_str(), NULL, 16));
+            i += 2;
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool load(const char* path, Transcript* transcript) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        printf("%s: can't open\n", path);
+        return false;
+    }
+
+    transcript->limitUs = 0;
+    int lineNum = 0;
+    bool ok = true;
+    while (ok && !feof(f)) {
+        lineNum++;
+        std::string line;
+        int c;
+        while ((c = getc(f)) != EOF && c != '\n') {
+            line += char(c);
+        }
+
+        Chunk chunk;
+        if (line.empty()) {
+            continue;
+        }
+        else if (line[0] == '#') {
+            transcript->comments.push_back(line);
+        }
+        else if (line.compare(0, 6, "limit ") == 0) {
+            transcript->limitUs = strtoul(line.c_str() + 6, NULL, 10);
+        }
+        else if (line.size() >= 2 && (line[0] == '>' || line[0] == '<') && line[1] == ' '
+                && unescape(line.substr(2), &chunk.bytes)) {
+            chunk.host = line[0] == '>';
+            transcript->chunks.push_back(chunk);
+        }
+        else {
+            printf("%s:%d: can't make sense of this line\n", path, lineNum);
+            ok = false;
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+// Writes the device's replies a line at a time, so the file reads like the
+// conversation it was.
+static bool save(const char* path, const Transcript& transcript) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        printf("%s: can't write\n", path);
+        return false;
+    }
+    for (const std::string& comment : transcript.comments) {
+        fprintf(f, "%s\n", comment.c_str());
+    }
+    fprintf(f, "limit %u\n", transcript.limitUs);
+    for (const Chunk& chunk : transcript.chunks) {
+        fprintf(f, "%c %s\n", chunk.host ? '>' : '<', escape(chunk.bytes).c_str());
+    }
+    fclose(f);
+    return true;
+}
+
+static std::vector<Chunk> deviceLines(const std::string& bytes) {
+    std::vector<Chunk> chunks;
+    size_t start = 0;
+    while (start < bytes.size()) {
+        size_t end = bytes.find('\n', start);
+        end = (end == std::string::npos) ? bytes.size() : end + 1;
+        chunks.push_back({ false, bytes.substr(start, end - start) });
+        start = end;
+    }
+    return chunks;
+}
+
+// Moves the device's bytes from collected up to end into chunks, a line at a
+// time.
+static void collect(const Link& link, size_t* collected, size_t end, std::vector<Chunk>* chunks) {
+    std::string replies;
+    for (size_t i = *collected; i < end; i++) {
+        replies += char(link.toHost[i].data);
+    }
+    *collected = end;
+    for (const Chunk& line : deviceLines(replies)) {
+        chunks->push_back(line);
+    }
+}
+
+// Runs main.cpp from reset with a fresh chip. Each host chunk is sent once
+// the device has sent everything before it in the transcript. Returns false,
+// with a message, if the device says anything different.
+//
+// When updating, what the device says isn't known yet. Each host chunk is
+// sent once the device has sent as many lines as the transcript has before
+// it, and as many bytes of any line it was sent partway through, and the
+// replies are collected into result. Returns false if the device goes quiet
+// short of that, or sends a different number of lines in all.
+static bool replay(const Transcript& transcript, bool update, Transcript* result,
+                   uint64_t* cycles, std::string* message) {
+    std::string expected;
+    std::vector<const Chunk*> hostChunks;
+    std::vector<size_t> waitBytes;      // device bytes before each host chunk
+    std::vector<size_t> waitLines;      // whole lines among them
+    std::vector<size_t> waitPartial;    // and bytes of the line after those
+    size_t expectedLines = 0;
+    size_t lineStart = 0;
+    for (const Chunk& chunk : transcript.chunks) {
+        if (chunk.host) {
+            hostChunks.push_back(&chunk);
+            waitBytes.push_back(expected.size());
+            waitLines.push_back(expectedLines);
+            waitPartial.push_back(expected.size() - lineStart);
+        }
+        else {
+            for (char c : chunk.bytes) {
+                expected += c;
+                if (c == '\n') {
+                    expectedLines++;
+                    lineStart = expected.size();
+                }
+            }
+        }
+    }
+
+    Link link;
+    sim_setSerialLink(&link);
+    sim_reset();
+    setup();
+
+    // The host opens the port long after the arduino started up, and misses
+    // what it said then.
+    link.flush();
+    link.toHost.clear();
+    uint64_t start = sim_cycles();
+
+    size_t sent = 0;
+    size_t checked = 0;
+    size_t reported = 0;
+    size_t collected = 0;
+    std::vector<size_t> lineEnds;   // the index after each newline the device sent
+    uint64_t lastOutput = sim_cycles();
+    std::vector<Chunk> chunks;
+
+    while (true) {
+        uint64_t now = sim_cycles();
+        for (; reported < link.toHost.size(); reported++) {
+            lastOutput = now;
+            if (link.toHost[reported].data == '\n') {
+                lineEnds.push_back(reported + 1);
+            }
+        }
+        auto quiet = [&]() {
+            return now - lastOutput >= Cycles_Settle && link.idle() && link.deviceDone <= now;
+        };
+
+        // The host sends whatever it's no longer waiting on, as soon as the
+        // last of what it was waiting for arrives.
+        while (sent < hostChunks.size()) {
+            size_t received;
+            if (!update) {
+                received = waitBytes[sent];
+                if (link.toHost.size() < received) {
+                    break;
+                }
+            }
+            else {
+                size_t lines = waitLines[sent];
+                received = (lines > 0 && lineEnds.size() >= lines) ? lineEnds[lines - 1] : 0;
+                received += waitPartial[sent];
+                if (lineEnds.size() < lines || link.toHost.size() < received) {
+                    if (quiet()) {
+                        *message = "the arduino went quiet after " + std::to_string(lineEnds.size())
+                                 + " lines, where the transcript has " + std::to_string(lines)
+                                 + " before the next > line";
+                        sim_setSerialLink(NULL);
+                        return false;
+                    }
+                    break;
+                }
+            }
+
+            if (update) {
+                collect(link, &collected, received, &chunks);
+                chunks.push_back(*hostChunks[sent]);
+            }
+            link.send(hostChunks[sent]->bytes, received > 0 ? link.toHost[received - 1].cycle : 0);
+            sent++;
+        }
+
+        // Check what's come back so far.
+        if (!update) {
+            for (; checked < link.toHost.size(); checked++) {
+                if (checked >= expected.size() || uint8_t(expected[checked]) != link.toHost[checked].data) {
+                    std::string got;
+                    for (size_t i = checked; i < link.toHost.size() && i < checked + 40; i++) {
+                        got += char(link.toHost[i].data);
+                    }
+                    *message = "at byte " + std::to_string(checked) + ", expected \""
+                             + escape(expected.substr(std::min(checked, expected.size()), 40))
+                             + "\", got \"" + escape(got) + "\"";
+                    sim_setSerialLink(NULL);
+                    return false;
+                }
+            }
+        }
+
+        if (sent == hostChunks.size() && quiet() && (update || checked == expected.size())) {
+            break;
+        }
+        if (now - lastOutput >= Cycles_Quiet && link.idle()) {
+            *message = "the arduino went quiet, still expecting \""
+                     + escape(expected.substr(checked, 40)) + "\"";
+            sim_setSerialLink(NULL);
+            return false;
+        }
+
+        loop();
+        sim_advance(Cycles_Loop);
+    }
+
+    if (update && lineEnds.size() != expectedLines) {
+        *message = "the arduino sent " + std::to_string(lineEnds.size()) + " lines, where the transcript has "
+                 + std::to_string(expectedLines);
+        sim_setSerialLink(NULL);
+        return false;
+    }
+    if (update) {
+        collect(link, &collected, link.toHost.size(), &chunks);
+        result->comments = transcript.comments;
+        result->limitUs = transcript.limitUs;
+        result->chunks = chunks;
+    }
+
+    // The session takes until the host has the last reply.
+    uint64_t end = link.toHost.empty() ? start : link.toHost.back().cycle;
+    *cycles = end - start;
+    sim_setSerialLink(NULL);
+    if (link.overruns > 0) {
+        *message = std::to_string(link.overruns) + " bytes overran the receive ring";
+        return false;
+    }
+    return true;
+}
+
+static bool sameChunks(const Transcript& a, const Transcript& b) {
+    if (a.chunks.size() != b.chunks.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.chunks.size(); i++) {
+        if (a.chunks[i].host != b.chunks[i].host || a.chunks[i].bytes != b.chunks[i].bytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t cyclesToUs(uint64_t cycles) {
+    return cycles / (c_simClockHz / 1000000);
+}
+
+// Runs fn in a child process, so main.cpp and the simulated chip and clock
+// start from a real reset, with all their statics cleared. Returns what fn
+// returned, or Pass_Failed if the child died.
+enum PassResult {
+    Pass_Ok,
+    Pass_Failed,
+    Pass_Changed,
+};
+
+static PassResult inChild(const std::function<PassResult()>& fn) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        PassResult result = fn();
+        fflush(stdout);
+        _exit(result);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? PassResult(WEXITSTATUS(status)) : Pass_Failed;
+}
+
+// Replays the transcript at path to collect what the arduino says now, and
+// saves that over it if it's different.
+static PassResult updatePass(const char* path) {
+    Transcript transcript;
+    if (!load(path, &transcript)) {
+        return Pass_Failed;
+    }
+    Transcript updated;
+    uint64_t cycles;
+    std::string message;
+    if (!replay(transcript, true, &updated, &cycles, &message)) {
+        printf("%-40s FAIL: %s\n", path, message.c_str());
+        return Pass_Failed;
+    }
+    if (sameChunks(updated, transcript)) {
+        return Pass_Ok;
+    }
+    return save(path, updated) ? Pass_Changed : Pass_Failed;
+}
+
+// Replays the transcript at path and checks it, and its time against the
+// limit. When updating, sets the limit instead.
+static PassResult checkPass(const char* path, bool update) {
+    Transcript transcript;
+    if (!load(path, &transcript)) {
+        return Pass_Failed;
+    }
+    uint64_t cycles;
+    std::string message;
+    if (!replay(transcript, false, NULL, &cycles, &message)) {
+        printf("%-40s FAIL: %s\n", path, message.c_str());
+        return Pass_Failed;
+    }
+    uint32_t us = cyclesToUs(cycles);
+
+    if (update) {
+        transcript.limitUs = (uint64_t) us * c_limitPercent / 100;
+        if (!save(path, transcript)) {
+            return Pass_Failed;
+        }
+    }
+
+    bool ok = transcript.limitUs == 0 || us <= transcript.limitUs;
+    printf("%-40s %s %10u us, limit %u us\n", path, ok ? "ok  " : "FAIL", us, transcript.limitUs);
+    return ok ? Pass_Ok : Pass_Failed;
+}
+
+static bool run(const char* path, bool update) {
+    // The first pass may have waited on the wrong replies, if what the
+    // arduino says has changed, and so sent things at different times from a
+    // check. Go again until it comes out the same.
+    for (int pass = 0; update && pass < c_updatePasses; pass++) {
+        PassResult result = inChild([=]() { return updatePass(path); });
+        if (result == Pass_Failed) {
+            return false;
+        }
+        if (result == Pass_Ok) {
+            break;
+        }
+    }
+    return inChild([=]() { return checkPass(path, update); }) == Pass_Ok;
+}
+
+// The directory part of path, with its slash, or nothing.
+static std::string dirName(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// Adds the transcripts in dir to paths, in order. Returns false if there
+// aren't any.
+static bool findTranscripts(const std::string& dir, std::vector<std::string>* paths) {
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL) {
+        return false;
+    }
+    size_t found = paths->size();
+    while (struct dirent* entry = readdir(d)) {
+        std::string name(entry->d_name);
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0) {
+            paths->push_back(dir + "/" + name);
+        }
+    }
+    closedir(d);
+    std::sort(paths->begin() + found, paths->end());
+    return paths->size() > found;
+}
+
+int main(int argc, char** argv) {
+    bool update = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        }
+        else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty()) {
+        std::string dirs[] = {
+            dirName(__FILE__) + c_transcriptDir,
+            dirName(argv[0]) + c_programToTranscripts,
+            c_projectToTranscripts,
+        };
+        for (const std::string& dir : dirs) {
+            if (findTranscripts(dir, &paths)) {
+                break;
+            }
+        }
+        if (paths.empty()) {
+            printf("No transcripts in %s, %s or %s\n", dirs[0].c_str(), dirs[1].c_str(), dirs[2].c_str());
+            return 1;
+        }
+    }
+
+    int failures = 0;
+    for (const std::string& path : paths) {
+        failures += !run(path.c_str(), update);
+    }
+    printf("%zu transcripts, %d failed\n", paths.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+#include "sim28c256.h"
+
+static const SimTiming c_defaultTiming = {
+    150,    // tBLC
+    5000,   // tWC, typical rather than the 10 ms worst case
+    20000,  // tEC
+};
+
+enum SimState {
+    Idle,
+    Loading,        // page load window open
+    Writing,        // write cycle in progress
+    Erasing,        // chip erase in progress
+};
+
+static SimTiming s_timing;
+static SimStats s_stats;
+static uint8_t s_memory[c_simRomSize];
+
+static SimState s_state;
+static uint64_t s_deadline;         // end of load window, or write cycle
+
+static uint8_t  s_page[c_simPageSize];
+static bool     s_pageLoaded[c_simPageSize];
+static uint16_t s_pageAddress;
+static uint8_t  s_lastData;         // last byte loaded, for DQ7 polling
+static bool     s_toggle;           // DQ6
+
+// The pins, as seen by the chip. The enables are active, not active-low.
+static uint16_t s_address;
+static uint16_t s_latchedAddress;   // latched on the falling edge of ~WE
+static uint8_t  s_dataIn;
+static bool     s_chipEnable;
+static bool     s_outputEnable;
+static bool     s_writeEnable;
+
+// The last six loads, to spot the chip erase sequence.
+const uint8_t c_eraseSequenceLength = 6;
+static const uint16_t c_eraseAddress[] = {
+    c_chip.unlock1, c_chip.unlock2, c_chip.unlock1, c_chip.unlock1, c_chip.unlock2, c_chip.unlock1,
+};
+static const uint8_t  c_eraseData[]    = {   0xaa,   0x55,   0x80,   0xaa,   0x55,   0x10 };
+static uint16_t s_recentAddress[c_eraseSequenceLength];
+static uint8_t  s_recentData[c_eraseSequenceLength];
+
+static uint64_t usToCycles(uint32_t us) {
+    return (uint64_t)us * (c_simClockHz / 1000000);
+}
+
+static void startWriteCycle(uint64_t start) {
+    s_state = Writing;
+    s_deadline = start + usToCycles(s_timing.writeCycleUs);
+}
+
+static void finishWriteCycle() {
+    for (uint8_t offset = 0; offset < c_simPageSize; offset++) {
+        if (s_pageLoaded[offset]) {
+            s_memory[s_pageAddress + offset] = s_page[offset];
+        }
+    }
+    s_stats.pageWrites++;
+    s_state = Idle;
+}
+
+// Catch up with the clock. Called before anything looks at the state.
+static void update() {
+    uint64_t now = sim_cycles();
+
+    if (s_state == Loading && now >= s_deadline) {
+        startWriteCycle(s_deadline);
+    }
+
+    if (s_state == Writing && now >= s_deadline) {
+        finishWriteCycle();
+    }
+
+    if (s_state == Erasing && now >= s_deadline) {
+        memset(s_memory, 0xff, sizeof(s_memory));
+        s_stats.erases++;
+        s_state = Idle;
+    }
+}
+
+static bool isEraseSequence() {
+    for (uint8_t i = 0; i < c_eraseSequenceLength; i++) {
+        if (s_recentAddress[i] != c_eraseAddress[i] || s_recentData[i] != c_eraseData[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void loadByte(uint16_t address, uint8_t data) {
+    if (s_state == Writing || s_state == Erasing) {
+        s_stats.ignoredLoads++;
+        return;
+    }
+
+    uint16_t pageAddress = address & ~(c_simPageSize - 1);
+
+    if (s_state == Idle) {
+        memset(s_pageLoaded, 0, sizeof(s_pageLoaded));
+        s_pageAddress = pageAddress;
+        s_state = Loading;
+    }
+    else if (pageAddress != s_pageAddress) {
+        // The datasheet says A6-A14 must not change during a page load. The
+        // real chip uses whatever page is on the bus at the end, so do that.
+        s_stats.pageViolations++;
+        s_pageAddress = pageAddress;
+    }
+
+    uint8_t offset = address & (c_simPageSize - 1);
+    s_page[offset] = data;
+    s_pageLoaded[offset] = true;
+    s_lastData = data;
+    s_deadline = sim_cycles() + usToCycles(s_timing.byteLoadCycleUs);
+    s_stats.byteLoads++;
+
+    memmove(s_recentAddress, s_recentAddress + 1, sizeof(s_recentAddress) - sizeof(s_recentAddress[0]));
+    memmove(s_recentData, s_recentData + 1, sizeof(s_recentData) - sizeof(s_recentData[0]));
+    s_recentAddress[c_eraseSequenceLength - 1] = address;
+    s_recentData[c_eraseSequenceLength - 1] = data;
+
+    if (isEraseSequence()) {
+        memset(s_recentAddress, 0, sizeof(s_recentAddress));
+        s_state = Erasing;
+        s_deadline = sim_cycles() + usToCycles(s_timing.eraseCycleUs);
+    }
+}
+
+// A read starts on the falling edge of ~OE or ~CE, whichever comes last.
+static void startRead() {
+    update();
+    if (s_state == Loading) {
+        startWriteCycle(sim_cycles());
+    }
+    if (s_state != Idle) {
+        s_toggle = !s_toggle;
+    }
+}
+
+void sim_reset(const SimTiming* timing) {
+    s_timing = timing != NULL ? *timing : c_defaultTiming;
+    memset(&s_stats, 0, sizeof(s_stats));
+    memset(s_memory, 0xff, sizeof(s_memory));
+    memset(s_recentAddress, 0, sizeof(s_recentAddress));
+    memset(s_recentData, 0, sizeof(s_recentData));
+    s_state = Idle;
+    s_toggle = false;
+    s_address = 0;
+    s_dataIn = 0;
+    s_chipEnable = false;
+    s_outputEnable = false;
+    s_writeEnable = false;
+}
+
+void sim_setAddress(uint16_t address) {
+    s_address = address & (c_simRomSize - 1);
+}
+
+void sim_setChipEnable(bool on) {
+    if (on && !s_chipEnable && s_outputEnable) {
+        startRead();
+    }
+    s_chipEnable = on;
+}
+
+void sim_setOutputEnable(bool on) {
+    if (on && !s_outputEnable && s_chipEnable) {
+        startRead();
+    }
+    s_outputEnable = on;
+}
+
+void sim_setWriteEnable(bool on) {
+    update();
+    if (s_chipEnable && !s_outputEnable) {
+        if (on && !s_writeEnable) {
+            s_latchedAddress = s_address;
+        }
+        else if (!on && s_writeEnable) {
+            loadByte(s_latchedAddress, s_dataIn);
+        }
+    }
+    s_writeEnable = on;
+}
+
+void sim_writeData(uint8_t data) {
+    s_dataIn = data;
+}
+
+uint8_t sim_readData() {
+    update();
+
+    if (!s_chipEnable || !s_outputEnable) {
+        return 0xff; // floating
+    }
+
+    if (s_state != Idle) {
+        s_stats.busyReads++;
+        return (~s_lastData & 0x80) | (s_toggle ? 0x40 : 0x00) | (s_lastData & 0x3f);
+    }
+
+    return s_memory[s_address];
+}
+
+bool sim_busy() {
+    update();
+    return s_state != Idle;
+}
+
+uint8_t sim_peek(uint16_t address) {
+    update();
+    return s_memory[address & (c_simRomSize - 1)];
+}
+
+void sim_poke(uint16_t address, uint8_t data) {
+    s_memory[address & (c_simRomSize - 1)] = data;
+}
+
+const SimStats& sim_stats() {
+    update();
+    return s_stats;
+}
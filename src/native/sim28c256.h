@@ -0,0 +1,62 @@
+#ifndef INCLUDE_SIM28C256_H
+#define INCLUDE_SIM28C256_H
+
+#include <Arduino.h>
+#include "chips.h"
+
+// A simulated AT28C256, driven by the native HAL in eeprom_burner.cpp. Its
+// size, page size and command addresses come from the chip in chips.h.
+//
+// It models the parts of the chip the burner cares about:
+//
+// - Page load: bytes latched on the rising edge of ~WE go into the page
+//   buffer. Each byte must follow the previous within tBLC, otherwise the
+//   load window closes and the write cycle starts. Reading the chip also
+//   closes the window.
+// - Write cycle: the page buffer is written to memory tWC after the window
+//   closes. Byte loads during the write cycle are ignored.
+// - Polling: during the write cycle, reads return the complement of bit 7 of
+//   the last byte loaded (DQ7 data polling), and bit 6 toggles on every read
+//   (DQ6 toggle bit).
+// - Software chip erase: the six byte AA/55/80/AA/55/10 sequence erases the
+//   whole chip in tEC.
+//
+// All times are measured on the simulated clock from the Arduino shim.
+
+const uint16_t c_simRomSize = c_romSize;
+const uint8_t  c_simPageSize = c_pageSize;
+
+struct SimTiming {
+    uint32_t byteLoadCycleUs;   // tBLC
+    uint32_t writeCycleUs;      // tWC
+    uint32_t eraseCycleUs;      // tEC
+};
+
+struct SimStats {
+    uint32_t byteLoads;         // bytes latched into the page buffer
+    uint32_t ignoredLoads;      // bytes latched while the chip was busy
+    uint32_t pageWrites;        // write cycles
+    uint32_t pageViolations;    // byte loads outside the page being loaded
+    uint32_t busyReads;         // reads that returned polling status
+    uint32_t erases;            // chip erases
+};
+
+extern void sim_reset(const SimTiming* timing = NULL);
+
+extern void sim_setAddress(uint16_t address);
+extern void sim_setChipEnable(bool on);
+extern void sim_setOutputEnable(bool on);
+extern void sim_setWriteEnable(bool on);
+extern void sim_writeData(uint8_t data);
+extern uint8_t sim_readData();
+
+// Is there a page load or write cycle in progress?
+extern bool sim_busy();
+
+// Direct access to the memory array, bypassing the bus.
+extern uint8_t sim_peek(uint16_t address);
+extern void sim_poke(uint16_t address, uint8_t data);
+
+extern const SimStats& sim_stats();
+
+#endif // INCLUDE_SIM28C256_H
@@ -0,0 +1,246 @@
+#include "receiver.h"
+
+const uint32_t c_rxTimeoutMillis = 1000;
+
+enum Assembling {
+    Assembling_None,
+    Assembling_Line,
+    Assembling_Frame,
+};
+
+static Assembling s_assembling = Assembling_None;
+static uint32_t s_lastByteMillis;
+static uint16_t s_ringFulls = 0;
+static bool s_ringWasFull = false;
+
+// When the current line or frame started to arrive, and how long the last
+// record or frame took to arrive in full.
+static uint32_t s_startMicros;
+static uint32_t s_receiveUs;
+static bool s_framesEnabled = false;
+
+// What went wrong with a frame while rx_pollFrame was assembling it, kept for
+// the next rx_poll to return, so loop counts it and NAKs.
+static RxStatus s_latched = rxStatus_None;
+
+static char* s_line;
+static uint16_t s_lineBufferSize;
+static uint16_t s_lineLength;
+static bool s_discardingLine;
+
+// Set to 'W', 'V' or 'F' when the line turns out to be an S-record. Its
+// characters then go to the decoder rather than the line buffer.
+static char s_recordOp;
+static SRec1Decoder s_decoder;
+
+static uint8_t s_frame[c_frameBufferSize];
+static uint16_t s_frameLength;
+
+static RxStatus pollLine();
+static RxStatus pollFrame();
+
+void rx_init(char* lineBuffer, uint16_t lineBufferSize) {
+    s_line = lineBuffer;
+    s_lineBufferSize = lineBufferSize;
+}
+
+void rx_setFramesEnabled(bool enabled) {
+    s_framesEnabled = enabled;
+    if (s_assembling == Assembling_Frame) {
+        s_assembling = Assembling_None;
+    }
+}
+
+uint32_t rx_receiveUs() {
+    return s_receiveUs;
+}
+
+uint16_t rx_ringFulls() {
+    return s_ringFulls;
+}
+
+RxStatus rx_poll() {
+    if (s_latched != rxStatus_None) {
+        RxStatus status = s_latched;
+        s_latched = rxStatus_None;
+        return status;
+    }
+
+    if (s_assembling == Assembling_None) {
+        int c = Serial.peek();
+        if (c < 0) {
+            return rxStatus_None;
+        }
+
+        if (s_framesEnabled && c == c_frameStart) {
+            s_assembling = Assembling_Frame;
+            s_frameLength = 0;
+        }
+        else {
+            s_assembling = Assembling_Line;
+            s_lineLength = 0;
+            s_discardingLine = false;
+            s_recordOp = 0;
+        }
+        s_startMicros = micros();
+    }
+
+    return (s_assembling == Assembling_Frame) ? pollFrame() : pollLine();
+}
+
+void rx_pollFrame() {
+    if (!s_framesEnabled) {
+        return;
+    }
+
+    if (s_assembling == Assembling_None) {
+        // Leave anything that isn't a frame for loop to deal with.
+        if (Serial.peek() != c_frameStart) {
+            return;
+        }
+        s_assembling = Assembling_Frame;
+        s_frameLength = 0;
+        s_startMicros = micros();
+    }
+
+    // A complete frame stays put until loop gets to it.
+    if (s_assembling == Assembling_Frame) {
+        RxStatus status = pollFrame();
+        if ((status == rxStatus_Timeout || status == rxStatus_BadFrame) && s_latched == rxStatus_None) {
+            s_latched = status;
+        }
+    }
+}
+
+const SRec1* rx_record(char* op) {
+    *op = s_recordOp;
+    return &s_decoder.record;
+}
+
+uint16_t rx_takeFrame(uint8_t* buffer) {
+    uint16_t size = s_frameLength;
+    memcpy(buffer, s_frame, size);
+    s_assembling = Assembling_None;
+    return size;
+}
+
+static void checkRingFull() {
+    // We can't see HardwareSerial dropping bytes, only that the ring is full,
+    // which it can be without losing anything if the host stops sending in
+    // time. Count each time it fills up, not each poll that finds it full.
+    bool full = Serial.available() >= SERIAL_RX_BUFFER_SIZE - 1;
+    if (full && !s_ringWasFull) {
+        s_ringFulls++;
+    }
+    s_ringWasFull = full;
+}
+
+// Called when nothing arrived. Rather than reading the clock for every byte,
+// we only look at it when a poll comes up empty.
+static bool timedOut(bool gotBytes) {
+    uint32_t now = millis();
+    if (gotBytes) {
+        s_lastByteMillis = now;
+        return false;
+    }
+    if (now - s_lastByteMillis < c_rxTimeoutMillis) {
+        return false;
+    }
+    s_assembling = Assembling_None;
+    return true;
+}
+
+static RxStatus pollLine() {
+    checkRingFull();
+
+    bool gotBytes = false;
+    while (Serial.available()) {
+        char c = Serial.read();
+        gotBytes = true;
+
+        if (c == '\n') {
+            s_assembling = Assembling_None;
+            if (s_recordOp != 0) {
+                // The record would have been returned as its checksum
+                // arrived, so it must be incomplete or invalid.
+                return rxStatus_BadRecord;
+            }
+            if (s_discardingLine) {
+                return rxStatus_LineOverrun;
+            }
+            // Empty lines are ignored.
+            if (s_lineLength == 0) {
+                return rxStatus_None;
+            }
+            s_line[s_lineLength] = 0;
+            return rxStatus_Line;
+        }
+
+        if (s_recordOp != 0) {
+            // Once the decoder has rejected the record, it ignores the rest
+            // of the line.
+            if (decodeSRec1(&s_decoder, c) == srecStatus_Ready) {
+                // The newline that follows will be an empty line.
+                s_assembling = Assembling_None;
+                s_receiveUs = micros() - s_startMicros;
+                return rxStatus_Record;
+            }
+            continue;
+        }
+
+        // A W, V or F followed by an S is a page op, with an S-record.
+        if (s_lineLength == 1 && c == 'S'
+                && (s_line[0] == 'W' || s_line[0] == 'V' || s_line[0] == 'F')) {
+            s_recordOp = s_line[0];
+            beginSRec1(&s_decoder);
+            decodeSRec1(&s_decoder, c);
+            continue;
+        }
+
+        // Keep space for the NUL. Once the line is too long, throw away the
+        // rest of it.
+        if (s_lineLength + 1 >= s_lineBufferSize) {
+            s_discardingLine = true;
+            continue;
+        }
+        s_line[s_lineLength++] = c;
+    }
+
+    return timedOut(gotBytes) ? rxStatus_Timeout : rxStatus_None;
+}
+
+// The number of bytes s_frame needs to hold, given what we've received so
+// far. Until we have the length byte, we only know about the header.
+static uint16_t frameSize() {
+    if (s_frameLength < c_frameHeaderSize) {
+        return c_frameHeaderSize;
+    }
+    return c_frameHeaderSize + s_frame[1] + c_frameTrailerSize;
+}
+
+static RxStatus pollFrame() {
+    checkRingFull();
+
+    bool gotBytes = false;
+    uint16_t size;
+    while (s_frameLength < (size = frameSize()) && size <= sizeof(s_frame)
+            && Serial.available()) {
+        s_frame[s_frameLength++] = Serial.read();
+        gotBytes = true;
+    }
+
+    if (size > sizeof(s_frame)) {
+        s_assembling = Assembling_None;
+        return rxStatus_BadFrame;
+    }
+
+    if (s_frameLength == size) {
+        // We only get bytes on the poll that completes the frame.
+        if (gotBytes) {
+            s_receiveUs = micros() - s_startMicros;
+        }
+        return rxStatus_Frame;
+    }
+
+    return timedOut(gotBytes) ? rxStatus_Timeout : rxStatus_None;
+}
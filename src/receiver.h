@@ -0,0 +1,59 @@
+#ifndef INCLUDE_RECEIVER_H
+#define INCLUDE_RECEIVER_H
+
+#include <Arduino.h>
+#include "frame.h"
+#include "srec.h"
+
+// Assembles command lines, S-records and page frames from the serial receive
+// ring, without blocking. S-records are decoded as they arrive, rather than
+// being buffered as a line.
+//
+// The ring is HardwareSerial's, filled by its RX interrupt. Its size comes
+// from SERIAL_RX_BUFFER_SIZE in platformio.ini, and needs to hold at least a
+// full frame. rx_poll is called from loop. rx_pollFrame is called from the
+// burner's poll hook, so frames keep arriving while a page is being written.
+// If a frame goes wrong there, the next rx_poll returns why.
+enum RxStatus {
+    rxStatus_None,          // nothing complete yet
+    rxStatus_Line,          // a line is in the line buffer, NUL terminated
+    rxStatus_Record,        // a W, V or F S-record is ready from rx_record
+    rxStatus_Frame,         // a frame is waiting for rx_takeFrame
+    rxStatus_LineOverrun,   // a line was too long, and has been discarded
+    rxStatus_BadRecord,     // an S-record was invalid or incomplete
+    rxStatus_BadFrame,      // a frame had an impossible length byte
+    rxStatus_Timeout,       // a partial line or frame went quiet
+};
+
+// Compared as ints, from its parts. c_frameBufferSize is a uint8_t, and
+// against a constant over 255 that warns it's always true.
+static_assert(SERIAL_RX_BUFFER_SIZE > c_frameHeaderSize + c_frameMaxLength + c_frameTrailerSize,
+              "receive ring must hold a full frame");
+
+extern void rx_init(char* lineBuffer, uint16_t lineBufferSize);
+
+// Frames are only recognised once the host has asked for binary mode.
+// Changing this drops any partial frame.
+extern void rx_setFramesEnabled(bool enabled);
+
+extern RxStatus rx_poll();
+extern void rx_pollFrame();
+
+// Returns the record, and sets op to 'W', 'V' or 'F'. The record stays put
+// until the next call to rx_poll.
+extern const SRec1* rx_record(char* op);
+
+// Copies the waiting frame to buffer, which must be at least
+// c_frameBufferSize bytes, and returns its size.
+extern uint16_t rx_takeFrame(uint8_t* buffer);
+
+// How long the last record or frame took to arrive, from its first byte to
+// its last, in microseconds.
+extern uint32_t rx_receiveUs();
+
+// The number of times the receive ring has filled up. HardwareSerial drops
+// bytes that arrive while it's full, but we can't tell whether any did, so
+// this is a sign the host is sending too far ahead, not a count of losses.
+extern uint16_t rx_ringFulls();
+
+#endif // INCLUDE_RECEIVER_H
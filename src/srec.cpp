@@ -1,77 +1,110 @@
+#include <Arduino.h>
 #include "srec.h"
 #include <stdlib.h>
 
-struct SRecord {
-    char header[2];
-    char byteCount[2];
-    char address[4];
-    char data[0];
+// The number of bytes in the record that aren't data: the address and the
+// checksum. The byte count itself isn't included in the byte count.
+const uint8_t c_srecOverhead = 3;
+
+// The value of each character from '0' to 'f', or 0xff if it isn't a hex
+// digit. Lowercase costs nothing extra this way, so it's accepted too.
+static const uint8_t c_hexDigits[] PROGMEM = {
+       0,    1,    2,    3,    4,    5,    6,    7,    8,    9,  // 0-9
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,                    // :-@
+      10,   11,   12,   13,   14,   15,                          // A-F
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,  // G-P
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,  // Q-Z
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff,                          // [-`
+      10,   11,   12,   13,   14,   15,                          // a-f
 };
 
+// One compare and a table lookup, rather than a compare and branch for each
+// range.
 static uint8_t hexChar(char hex) {
-    if (hex >= '0' && hex <= '9') {
-        return hex - '0';
-    }
-    if (hex >= 'A' && hex <= 'F') {
-        return hex - 'A' + 10;
+    uint8_t index = uint8_t(hex - '0');
+    if (index >= sizeof(c_hexDigits)) {
+        return 0xff;
     }
-    return 0xff;
+    return pgm_read_byte(&c_hexDigits[index]);
 }
 
-static uint8_t read8(const char* buf) {
-    return (hexChar(buf[0]) << 4) | (hexChar(buf[1]));
+void beginSRec1(SRec1Decoder* decoder) {
+    decoder->byteCount = 0;
+    decoder->bytesDecoded = 0;
+    decoder->checksum = 0;
+    decoder->chars = 0;
+    decoder->invalid = false;
 }
 
-static void bswap(uint16_t* p) {
-    uint8_t* hp = (uint8_t*) p;
-    uint8_t t = hp[0];
-    hp[0] = hp[1];
-    hp[1] = t;
+static SRecStatus invalid(SRec1Decoder* decoder) {
+    decoder->invalid = true;
+    return srecStatus_Invalid;
 }
 
-SRec1* parseSRec1(char* buffer, uint16_t size) {
-
-    SRecord* in = (SRecord*) buffer;
+SRecStatus decodeSRec1(SRec1Decoder* decoder, char c) {
+    if (decoder->invalid) {
+        return srecStatus_Invalid;
+    }
 
     // Check the header makes sense.
-    if ((in->header[0] != 'S') || (in->header[1] != '1')) {
-        return NULL;
+    if (decoder->chars < 2) {
+        if (c != "S1"[decoder->chars]) {
+            return invalid(decoder);
+        }
+        decoder->chars++;
+        return srecStatus_More;
     }
 
-    // Convert the data in-place. The SRec1 will always be smaller than the
-    // original SRecord, so this fits.
-    SRec1* out = (SRec1*) buffer;
-
-    // Before we go running off the end of crazyland, check that the data size
-    // makes sense. size = dataSize * 2 + (2 + 2 + 4 + 2)
-    uint8_t byteCount = read8(in->byteCount);
-    if (byteCount * 2u + 4u != size) {
-        return NULL;
+    // byteCount is only zero before we've decoded it, so this catches anything
+    // after the checksum.
+    if (decoder->byteCount != 0 && decoder->bytesDecoded > decoder->byteCount) {
+        return invalid(decoder);
     }
 
-    // Compute the checksum and convert the data in one pass.
-    uint8_t checksum = 0;
-    char* src = buffer + 2;
-    uint8_t* dest = &(out->dataSize);
-    uint16_t n = byteCount; // plus one for dataSize, less one for checksum
-    for (uint16_t i = 0; i < n; i++) {
-        uint8_t value = read8(&src[i * 2]);
-        checksum += value;
-        dest[i] = value;
+    uint8_t nibble = hexChar(c);
+    if (nibble == 0xff) {
+        return invalid(decoder);
     }
 
-    // XOR the final checksum value with the declared one. It should be zero.
-    checksum ^= read8(&src[n * 2]);
-    if (checksum != 0xff) {
-        return NULL;
+    // Hold on to the first digit of each pair.
+    if (decoder->chars == 2) {
+        decoder->highNibble = nibble;
+        decoder->chars++;
+        return srecStatus_More;
     }
+    decoder->chars = 2;
 
-    // The fields will already have been converted. We just need to fix up
-    // the address & dataSize.
-    bswap(&out->address);
-    out->dataSize -= 3;
-
-    return out;
-}
+    uint8_t value = (decoder->highNibble << 4) | nibble;
+    uint8_t index = decoder->bytesDecoded++;
+    decoder->checksum += value;
 
+    SRec1* record = &decoder->record;
+    if (index == 0) {
+        // Before we go running off the end of crazyland, check that the data
+        // size makes sense.
+        if (value < c_srecOverhead || value - c_srecOverhead > c_srecMaxData) {
+            return invalid(decoder);
+        }
+        decoder->byteCount = value;
+        record->dataSize = value - c_srecOverhead;
+    }
+    else if (index == 1) {
+        record->address = uint16_t(value) << 8;
+    }
+    else if (index == 2) {
+        record->address |= value;
+    }
+    else if (index < decoder->byteCount) {
+        record->data[index - c_srecOverhead] = value;
+    }
+    else {
+        // That was the checksum. Adding it to the sum of everything else
+        // should give 0xff.
+        if (decoder->checksum != 0xff) {
+            return invalid(decoder);
+        }
+        return srecStatus_Ready;
+    }
 
+    return srecStatus_More;
+}
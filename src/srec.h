@@ -2,20 +2,41 @@
 #define INCLUDE_SREC_H
 
 #include <stdint.h>
+#include "chips.h"
+
+// A record can't write across a page boundary, so there's no point accepting
+// more data than a page holds.
+const uint8_t c_srecMaxData = c_pageSize;
 
 struct SRec1 {
-    char header[2];
     uint8_t dataSize;
     uint16_t address;
-    uint8_t data[252];
+    uint8_t data[c_srecMaxData];
+};
+
+enum SRecStatus {
+    srecStatus_More,        // keep feeding characters
+    srecStatus_Ready,       // the record is complete, and the checksum matched
+    srecStatus_Invalid,     // not a valid S1 record
+};
+
+// Decodes an S1 record a character at a time, as it arrives, so there's no
+// need to buffer the whole line. Each pair of hex digits is converted and
+// added to the checksum as soon as it is complete.
+struct SRec1Decoder {
+    SRec1 record;
+    uint8_t byteCount;      // from the record, once we have it
+    uint8_t bytesDecoded;
+    uint8_t checksum;
+    uint8_t highNibble;
+    uint8_t chars;          // characters seen, up to the first hex pair
+    bool invalid;
 };
 
-// If buffer is a valid S1 record, returns pointer to SRec1, otherwise NULL.
-// The buffer is overwritten with the contents of SRec1. SRec1 is always smaller
-// than the input buffer.
-extern SRec1* parseSRec1(char* buffer, uint16_t size);
+extern void beginSRec1(SRec1Decoder* decoder);
 
-// Input record will be a maximum of 2 + 2 + 255 * 2 = 514 bytes
-const uint16_t c_srecBufferSize = 515; // allow space for a newline
+// Returns srecStatus_Ready as the final checksum digit arrives, at which point
+// decoder->record holds the record. Anything after that is invalid.
+extern SRecStatus decodeSRec1(SRec1Decoder* decoder, char c);
 
 #endif // INCLUDE_SREC_H